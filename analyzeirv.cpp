@@ -148,7 +148,9 @@ int main(int argc, const char *argv[]) {
             NMNode node(winner);
             node.elim_seq = elim_order;
             node.dist = -1;
-            double objval = promoting_nonmono_distance(candidates[winner], ballots, candidates, config, node,
+            NMContext ctx;
+            build_promoting_context(candidates[winner], ballots, config, ctx);
+            double objval = promoting_nonmono_distance(ctx, candidates, config, node,
                                                        -1., -1., log, true, timeout_flag);
             cout << "JIRIDEBUG: objval = " << objval << endl;
             if (log.is_open())
@@ -0,0 +1,215 @@
+/*
+    Copyright (C) 2016-2019  Michelle Blom
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include<iostream>
+#include<string.h>
+#include<stdlib.h>
+#include<random>
+#include<algorithm>
+
+#include "model.h"
+#include "prefix_mask.h"
+
+using namespace std;
+
+// USAGE: benchscore -ballots [ballot file] [-reps N] [-seqlen K] [-seed S]
+//
+// -ballots:   Ballot profile (text or binary format)
+// -reps:      Number of times each count is repeated (default 10)
+// -seqlen:    Length of the elimination sequences considered (default 3)
+// -seed:      Seed for choosing sequences (default 1)
+//
+// Microbenchmark of the counts made by the tight scoring rule. For each
+// candidate 'c', a random sequence of 'seqlen' candidates starting with 
+// 'c' is chosen, and for every other candidate 'e' the votes of ballots
+// ranking 'c' above 'e' and the rest of the sequence are counted, both by
+// walking each ballot's preferences (as ApplyScoringRules did) and with 
+// the prefix mask kernel. Prints the time taken by each, and checks that
+// they give the same counts.
+
+// Count by walking the preferences of each ballot in 'store'.
+static int CountByWalk(const BallotStore &store, const Ints &alive, 
+	int c, int e){
+	int vcntr = 0;
+	for(int b = 0; b < store.Size(); ++b){
+		for(const Pref *jt = store.Begin(b); jt != store.End(b); ++jt){
+			if(*jt == c){
+				vcntr += store.votes[b];
+				break;
+			}
+			else if(*jt == e){
+				break;
+			}
+			else if(alive[*jt] == 1){
+				break;
+			}
+		}
+	}
+	return vcntr;
+}
+
+int main(int argc, const char * argv[]) 
+{
+	try{
+		Candidates candidates;
+		Ballots ballots; 
+		Config config;
+
+		const char *inf = NULL;
+		int reps = 10;
+		int seqlen = 3;
+		int seed = 1;
+
+		for(int i = 1; i < argc; ++i){
+			if(strcmp(argv[i], "-ballots") == 0 && i < argc-1){
+				inf = argv[i+1];
+				++i;
+			}
+			else if(strcmp(argv[i], "-reps") == 0 && i < argc-1){
+				reps = max(1, atoi(argv[i+1]));
+				++i;
+			}
+			else if(strcmp(argv[i], "-seqlen") == 0 && i < argc-1){
+				seqlen = max(1, atoi(argv[i+1]));
+				++i;
+			}
+			else if(strcmp(argv[i], "-seed") == 0 && i < argc-1){
+				seed = atoi(argv[i+1]);
+				++i;
+			}
+		}
+
+		if(inf == NULL){
+			cout << "USAGE: benchscore -ballots [ballot file] [-reps N] "
+				<< "[-seqlen K] [-seed S]" << endl;
+			return 1;
+		}
+
+		if(!ReadBallots(inf, ballots, candidates, config)){
+			cout << "Ballot read error. Exiting." << endl;
+			return 1;
+		}
+
+		const int ncand = config.ncandidates;
+		if(ncand > MAX_TREE_CANDIDATES){
+			cout << "Too many candidates (more than " << 
+				MAX_TREE_CANDIDATES << "). Exiting." << endl;
+			return 1;
+		}
+
+		const BallotStore &store = GetBallotStore(ballots, config);
+		seqlen = min(seqlen, ncand - 1);
+
+		mt19937 rng(seed);
+		Ints2d seqs(ncand);
+		for(int c = 0; c < ncand; ++c){
+			Ints others;
+			for(int o = 0; o < ncand; ++o){
+				if(o != c) others.push_back(o);
+			}
+			shuffle(others.begin(), others.end(), rng);
+			seqs[c].push_back(c);
+			seqs[c].insert(seqs[c].end(), others.begin(), 
+				others.begin() + seqlen - 1);
+		}
+
+		// Preference walk
+		mytimespec start, end;
+		Ints2d walked(ncand, Ints(ncand, 0));
+		GetTime(&start);
+		for(int k = 0; k < reps; ++k){
+			for(int c = 0; c < ncand; ++c){
+				Ints alive(ncand, 0);
+				for(int j = 0; j < seqs[c].size(); ++j){
+					alive[seqs[c][j]] = 1;
+				}
+				for(int e = 0; e < ncand; ++e){
+					if(alive[e]) continue;
+					walked[c][e] = CountByWalk(store, alive, c, e);
+				}
+			}
+		}
+		GetTime(&end);
+		const double twalk = end.seconds - start.seconds;
+
+		// Prefix masks (including the time taken to build them)
+		Ints2d masked(ncand, Ints(ncand, 0));
+		bool built = true;
+		GetTime(&start);
+		for(int k = 0; k < reps && built; ++k){
+			for(int c = 0; c < ncand && built; ++c){
+				PrefixMasks masks;
+				if(!masks.Build(store, ncand, c)){
+					built = false;
+					break;
+				}
+
+				CandMask seqmask = 0;
+				for(int j = 1; j < seqs[c].size(); ++j){
+					seqmask |= CandMask(1) << seqs[c][j];
+				}
+				for(int e = 0; e < ncand; ++e){
+					if(e == c || ((seqmask >> e) & 1)) continue;
+					masked[c][e] = masks.Count(seqmask | (CandMask(1) << e));
+				}
+			}
+		}
+		GetTime(&end);
+		const double tmask = end.seconds - start.seconds;
+
+		if(!built){
+			cout << "Profile has fractional votes; prefix masks are not "
+				<< "used. Exiting." << endl;
+			return 1;
+		}
+
+		cout << "Signatures:   " << store.Size() << endl;
+		cout << "Candidates:   " << ncand << endl;
+		cout << "Counts:       " << reps*ncand*(ncand-seqlen) << endl;
+		cout << "Walk:         " << twalk << " s" << endl;
+		cout << "Prefix masks: " << tmask << " s";
+		#ifdef __AVX2__
+		cout << " (AVX2)" << endl;
+		#else
+		cout << " (scalar)" << endl;
+		#endif
+		cout << "Counts agree: " << (walked == masked ? "yes" : "NO") << endl;
+
+		if(walked != masked){
+			return 1;
+		}
+	}
+	catch(exception &e)
+	{
+		cout << e.what() << endl;
+		cout << "Exiting." << endl;
+		return 1;
+	}
+	catch(STVException &e)
+	{
+		cout << e.what() << endl;
+		cout << "Exiting." << endl;
+		return 1;
+	}	
+	catch(...)
+	{
+		cout << "Unexpected error. Exiting." << endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,280 @@
+/*
+    Copyright (C) 2016-2019  Michelle Blom
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include<iostream>
+#include<iomanip>
+#include<string.h>
+#include<stdlib.h>
+#include<algorithm>
+#include<cmath>
+#include<random>
+#include<thread>
+#include<atomic>
+
+#include "model.h"
+#include "sim_irv.h"
+
+using namespace std;
+
+// Settings for resampling
+struct BootstrapConfig
+{
+	int samples;
+	int nthreads;
+	unsigned long long seed;
+
+	// Size of each sample as a fraction of the total number of votes
+	double fraction;
+
+	// Draw the number of votes for each signature independently from a
+	// Poisson distribution, rather than drawing a fixed number of ballots
+	// (multinomial resampling).
+	bool poisson;
+
+	BootstrapConfig() : samples(1000), nthreads(1), seed(1), fraction(1),
+		poisson(false) {}
+};
+
+// Outcome of the count of one sample
+struct SampleOutcome
+{
+	int winner;
+	int lrm;
+};
+
+// Draw the number of votes for each signature in sample 'sample'. Each
+// sample has its own random number generator, seeded from the sample
+// index, so that results do not depend on the number of threads.
+void DrawSample(const Ballots &ballots, const Config &config,
+	const BootstrapConfig &bc, int sample, Doubles &votecounts)
+{
+	seed_seq seq{(unsigned)(bc.seed >> 32), (unsigned)bc.seed, 
+		(unsigned)sample};
+	mt19937_64 rng(seq);
+
+	votecounts.resize(ballots.size());
+
+	if(bc.poisson){
+		for(int i = 0; i < ballots.size(); ++i){
+			// A Poisson distribution needs a positive mean
+			const double mean = ballots[i].votes*bc.fraction;
+			if(mean > 0){
+				poisson_distribution<long long> pd(mean);
+				votecounts[i] = pd(rng);
+			}
+			else{
+				votecounts[i] = 0;
+			}
+		}
+		return;
+	}
+
+	// Multinomial: draw the votes for each signature from the votes
+	// remaining, given those drawn for earlier signatures.
+	long long remaining = llround(config.totalvotes * bc.fraction);
+	double mass = config.totalvotes;
+	for(int i = 0; i < ballots.size(); ++i){
+		if(remaining <= 0 || mass <= 0){
+			votecounts[i] = 0;
+			continue;
+		}
+
+		const double p = min(1.0, ballots[i].votes / mass);
+		binomial_distribution<long long> bd(remaining, p);
+		const long long n = (p >= 1) ? remaining : bd(rng);
+
+		votecounts[i] = n;
+		remaining -= n;
+		mass -= ballots[i].votes;
+	}
+}
+
+// Simulate samples taken from 'next' until all have been counted.
+void BootstrapWorker(const Ballots &ballots, const Candidates &candidates,
+	const Config &config, const BootstrapConfig &bc, atomic<int> &next,
+	vector<SampleOutcome> &outcomes)
+{
+	SimWorkspace ws;
+	SimResult result;
+	Doubles votecounts;
+
+	int s;
+	while((s = next++) < bc.samples){
+		DrawSample(ballots, config, bc, s, votecounts);
+		SimulateIRV(ballots, votecounts, candidates, config, ws, result);
+
+		outcomes[s].winner = result.winner;
+		outcomes[s].lrm = ceil(result.last_round_margin/2.0);
+	}
+}
+
+// USAGE: bootstrapirv -ballots [ballot file] [-samples N] [-threads N]
+//            [-seed N] [-fraction F] [-poisson]
+//
+// -samples:   Number of resampled profiles to count (default 1000)
+// -threads:   Number of threads used to count samples (default 1)
+// -seed:      Seed for random number generation (default 1). Results for
+//             a given seed do not depend on the number of threads.
+// -fraction:  Size of each sample, as a fraction of the total number of 
+//             votes (default 1). Use a fraction below 1 to estimate the
+//             stability of the outcome during a partial count.
+// -poisson:   Draw the number of votes for each ballot signature from a 
+//             Poisson distribution (Poisson bootstrap). By default, a fixed
+//             number of ballots is drawn with replacement.
+//
+// Reports how often each candidate wins across the samples, and quantiles
+// of the last round margin (LRM).
+int main(int argc, const char * argv[]) 
+{
+	try{
+		Candidates candidates;
+		Ballots ballots; 
+		Config config;
+		BootstrapConfig bc;
+
+		bool read = false;
+
+		for(int i = 1; i < argc; ++i){
+			if(strcmp(argv[i], "-ballots") == 0 && i < argc-1){
+				if(!ReadBallots(argv[i+1], ballots, candidates, config)){
+					cout << "Ballot read error. Exiting." << endl;
+					return 1;
+				}
+				read = true;
+				++i;
+			}
+			else if(strcmp(argv[i], "-samples") == 0 && i < argc-1){
+				bc.samples = max(1, atoi(argv[i+1]));
+				++i;
+			}
+			else if(strcmp(argv[i], "-threads") == 0 && i < argc-1){
+				bc.nthreads = max(1, atoi(argv[i+1]));
+				++i;
+			}
+			else if(strcmp(argv[i], "-seed") == 0 && i < argc-1){
+				bc.seed = strtoull(argv[i+1], NULL, 10);
+				++i;
+			}
+			else if(strcmp(argv[i], "-fraction") == 0 && i < argc-1){
+				bc.fraction = atof(argv[i+1]);
+				++i;
+			}
+			else if(strcmp(argv[i], "-poisson") == 0){
+				bc.poisson = true;
+			}
+		}
+
+		if(!read){
+			cout << "USAGE: bootstrapirv -ballots [ballot file] "
+				<< "[-samples N] [-threads N] [-seed N] [-fraction F] "
+				<< "[-poisson]" << endl;
+			return 1;
+		}
+
+		if(!(bc.fraction > 0)){
+			throw STVException("Sample fraction must be positive.");
+		}
+
+		mytimespec start;
+		GetTime(&start);
+
+		// Outcome of the count of the original profile
+		Doubles votecounts(ballots.size(), 0);
+		for(int i = 0; i < ballots.size(); ++i){
+			votecounts[i] = ballots[i].votes;
+		}
+
+		SimWorkspace ws;
+		SimResult original;
+		SimulateIRV(ballots, votecounts, candidates, config, ws, original);
+
+		vector<SampleOutcome> outcomes(bc.samples);
+		atomic<int> next(0);
+
+		if(bc.nthreads > 1){
+			vector<thread> workers;
+			for(int i = 0; i < bc.nthreads; ++i){
+				workers.push_back(thread(BootstrapWorker, cref(ballots),
+					cref(candidates), cref(config), cref(bc), ref(next),
+					ref(outcomes)));
+			}
+			for(int i = 0; i < workers.size(); ++i){
+				workers[i].join();
+			}
+		}
+		else{
+			BootstrapWorker(ballots, candidates, config, bc, next, outcomes);
+		}
+
+		mytimespec tend;
+		GetTime(&tend);
+
+		// Winner frequencies
+		Ints wins(candidates.size(), 0);
+		Ints lrms(bc.samples);
+		for(int s = 0; s < bc.samples; ++s){
+			if(outcomes[s].winner >= 0){
+				++wins[outcomes[s].winner];
+			}
+			lrms[s] = outcomes[s].lrm;
+		}
+		sort(lrms.begin(), lrms.end());
+
+		cout << "Winner:     " << candidates[original.winner].name << endl;
+		cout << "LRM:        " << ceil(original.last_round_margin/2.0) 
+			<< endl;
+		cout << "Samples:    " << bc.samples << endl;
+
+		cout << "Winner frequencies:" << endl;
+		for(int c = 0; c < candidates.size(); ++c){
+			if(wins[c] == 0) continue;
+			cout << "  Candidate " << candidates[c].name << " " << wins[c] <<
+				" (" << fixed << setprecision(4) << 
+				wins[c]/(double)bc.samples << ")" << endl;
+		}
+		cout.unsetf(ios::floatfield);
+
+		const double qs[] = {0, 0.05, 0.25, 0.5, 0.75, 0.95, 1};
+		cout << "LRM quantiles:" << endl;
+		for(int i = 0; i < sizeof(qs)/sizeof(qs[0]); ++i){
+			const int idx = min(bc.samples-1, (int)floor(qs[i]*bc.samples));
+			cout << "  " << setw(4) << qs[i]*100 << "%: " << lrms[idx] << endl;
+		}
+
+		cout << "Total time: " << tend.seconds - start.seconds << endl;
+	}
+	catch(exception &e)
+	{
+		cout << e.what() << endl;
+		cout << "Exiting." << endl;
+		return 1;
+	}
+	catch(STVException &e)
+	{
+		cout << e.what() << endl;
+		cout << "Exiting." << endl;
+		return 1;
+	}	
+	catch(...)
+	{
+		cout << "Unexpected error. Exiting." << endl;
+		return 1;
+	}
+
+	return 0;
+}
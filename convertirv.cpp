@@ -0,0 +1,95 @@
+/*
+    Copyright (C) 2016-2019  Michelle Blom
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include<iostream>
+#include<string.h>
+
+#include "model.h"
+
+using namespace std;
+
+// USAGE: convertirv -ballots [ballot file] -out [binary ballot file]
+//
+// -ballots:   Ballot profile in text format
+// -out:       File to which the profile is written in binary format
+//
+// The binary file holds the candidates, their party affiliations, and the
+// distinct ballot signatures (with the number of votes for each) of the
+// profile. It can be passed to marginirv and analyzeirv with -ballots in
+// place of the text file, and is loaded without parsing.
+int main(int argc, const char * argv[]) 
+{
+	try{
+		Candidates candidates;
+		Ballots ballots; 
+		Config config;
+
+		const char *inf = NULL;
+		const char *outf = NULL;
+
+		for(int i = 1; i < argc; ++i){
+			if(strcmp(argv[i], "-ballots") == 0 && i < argc-1){
+				inf = argv[i+1];
+				++i;
+			}
+			else if(strcmp(argv[i], "-out") == 0 && i < argc-1){
+				outf = argv[i+1];
+				++i;
+			}
+		}
+
+		if(inf == NULL || outf == NULL){
+			cout << "USAGE: convertirv -ballots [ballot file] -out "
+				<< "[binary ballot file]" << endl;
+			return 1;
+		}
+
+		if(!ReadBallots(inf, ballots, candidates, config)){
+			cout << "Ballot read error. Exiting." << endl;
+			return 1;
+		}
+
+		if(!WriteBinaryBallots(outf, ballots, candidates, config)){
+			cout << "Ballot write error. Exiting." << endl;
+			return 1;
+		}
+
+		cout << "Wrote " << ballots.size() << " signatures, " << 
+			config.totalvotes << " votes and " << candidates.size() << 
+			" candidates to " << outf << endl;
+	}
+	catch(exception &e)
+	{
+		cout << e.what() << endl;
+		cout << "Exiting." << endl;
+		return 1;
+	}
+	catch(STVException &e)
+	{
+		cout << e.what() << endl;
+		cout << "Exiting." << endl;
+		return 1;
+	}	
+	catch(...)
+	{
+		cout << "Unexpected error. Exiting." << endl;
+		return 1;
+	}
+
+	return 0;
+}
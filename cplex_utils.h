@@ -16,7 +16,12 @@
 */
 
 
+#ifndef _CPLEX_UTILS_H
+#define _CPLEX_UTILS_H
+
 #include<ilcplex/ilocplex.h>
+#include<mutex>
+#include<vector>
 
 typedef IloArray<IloNumVarArray> NumVarArray2D;
 typedef IloArray<NumVarArray2D> NumVarArray3D;
@@ -33,4 +38,80 @@ typedef IloArray<ExprArray1D> ExprArray2D;
 typedef IloArray<ExprArray2D> ExprArray3D;
 typedef IloArray<ExprArray3D> ExprArray4D;
 
+// CPLEX environments kept for reuse, so that solving an LP does not pay
+// for creating and destroying one. An environment may only be returned to
+// the pool once everything created in it for an LP has been ended (see
+// EndModel), as it would otherwise accumulate.
+class EnvPool{
+	private:
+		std::mutex lock;
+		std::vector<IloEnv> envs;
+
+	public:
+		~EnvPool(){
+			for(int i = 0; i < envs.size(); ++i){
+				envs[i].end();
+			}
+		}
+
+		IloEnv Get(){
+			std::lock_guard<std::mutex> guard(lock);
+			if(envs.empty()){
+				return IloEnv();
+			}
+			IloEnv env = envs.back();
+			envs.pop_back();
+			return env;
+		}
+
+		void Put(IloEnv env){
+			std::lock_guard<std::mutex> guard(lock);
+			envs.push_back(env);
+		}
+};
+
+// Pool shared by all LPs solved by the program
+inline EnvPool& SolverEnvs(){
+	static EnvPool pool;
+	return pool;
+}
+
+// An environment checked out of SolverEnvs() for one LP. If the LP is 
+// abandoned (by an exception) before Release() is called, the environment
+// is ended rather than returned, as it may still hold objects of the LP.
+class PooledEnv{
+	private:
+		IloEnv env;
+		bool released;
+
+	public:
+		PooledEnv() : env(SolverEnvs().Get()), released(false) {}
+		~PooledEnv(){
+			if(!released){
+				env.end();
+			}
+		}
+
+		IloEnv Env() const { return env; }
+
+		// Return the environment to the pool. Everything created in it
+		// must have been ended.
+		void Release(){
+			released = true;
+			SolverEnvs().Put(env);
+		}
+};
+
+// End a model and every constraint and objective added to it. Variables 
+// are not ended, as they may be shared with other models.
+inline void EndModel(IloModel model){
+	IloExtractableArray elems(model.getEnv());
+	for(IloModel::Iterator it(model); it.ok(); ++it){
+		elems.add(*it);
+	}
+	model.end();
+	elems.endElements();
+	elems.end();
+}
 
+#endif
@@ -0,0 +1,278 @@
+/*
+    Copyright (C) 2016-2019  Michelle Blom
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include<algorithm>
+#include<cmath>
+#include<sstream>
+#include<iomanip>
+#include "distance_cache.h"
+
+using namespace std;
+
+// Identifies a file as an LP result store, and the layout of its records.
+static const char STORE_MAGIC[8] = {'M','I','R','V','L','P','C','1'};
+
+// Header of an LP result store. The number of candidates, ballots and
+// votes are checked in addition to the profile hash when a store is 
+// opened.
+struct StoreHeader{
+	char magic[8];
+	unsigned long long hash;
+	int ncandidates;
+	int nballots;
+	double totalvotes;
+};
+
+string DistanceKey(const Node &node){
+	return string((const char*)node.elim, node.len);
+}
+
+// Mix the bits of a 64-bit value (splitmix64 finaliser).
+static unsigned long long Mix(unsigned long long h){
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+// Add 'len' bytes to a 64-bit FNV-1a hash.
+static unsigned long long FNV(unsigned long long h, const void *data, 
+	size_t len){
+	const unsigned char *bytes = (const unsigned char*)data;
+	for(size_t i = 0; i < len; ++i){
+		h ^= bytes[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+unsigned long long ProfileHash(const Ballots &ballots, 
+	const Config &config){
+	// Each ballot is hashed separately, and the hashes summed, so that
+	// the result does not depend on the order of 'ballots'.
+	unsigned long long sum = 0;
+	for(Ballots::const_iterator it = ballots.begin(); 
+		it != ballots.end(); ++it){
+		unsigned long long h = 0xcbf29ce484222325ULL;
+		h = FNV(h, &it->votes, sizeof(double));
+		const int nprefs = it->prefs.size();
+		h = FNV(h, &nprefs, sizeof(int));
+		if(nprefs > 0){
+			h = FNV(h, &it->prefs[0], nprefs*sizeof(int));
+		}
+		sum += Mix(h);
+	}
+
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	h = FNV(h, &config.ncandidates, sizeof(int));
+	h = FNV(h, &sum, sizeof(sum));
+	return Mix(h);
+}
+
+// The LP for a node is solved with its score as a lower bound on the
+// objective, and the larger of this and the current upper bound as an
+// upper bound (see distance()).
+static double EffectiveLowerBound(const Node &node){
+	return max(0.0, node.dist);
+}
+
+static double EffectiveUpperBound(const Node &node, double upperbound){
+	return max(EffectiveLowerBound(node), upperbound);
+}
+
+// True if the cached result 'cd' is the optimal value of the LP, rather
+// than a value clipped by the lower bound it was solved with.
+static bool IsExact(const CachedDistance &cd){
+	return !cd.timeout && cd.dist >= 0 && cd.dist > cd.lbound;
+}
+
+// True if result 'a' can be reused in more situations than 'b'.
+static bool MoreReusable(const CachedDistance &a, const CachedDistance &b){
+	if(a.timeout || b.timeout){
+		return !a.timeout;
+	}
+	if(IsExact(b)){
+		return false;
+	}
+	if(IsExact(a)){
+		return true;
+	}
+	if(a.dist >= 0 && b.dist >= 0){
+		return a.lbound < b.lbound;
+	}
+	if(a.dist < 0 && b.dist < 0){
+		return a.ubound > b.ubound;
+	}
+	return a.dist >= 0;
+}
+
+bool DistanceCache::Lookup(const Node &node, double upperbound, 
+	double &dist){
+	lock_guard<mutex> guard(lock);
+
+	unordered_map<string,CachedDistance>::const_iterator it = 
+		entries.find(DistanceKey(node));
+
+	if(it != entries.end() && !it->second.timeout){
+		const CachedDistance &cd = it->second;
+		const double lb = EffectiveLowerBound(node);
+		const double ub = EffectiveUpperBound(node, upperbound);
+
+		if(cd.dist >= 0){
+			if(cd.dist > cd.lbound || lb >= cd.lbound){
+				const double d = ceil(max(cd.dist, lb));
+				dist = (d <= ub) ? d : -1;
+				++hits;
+				return true;
+			}
+		}
+		else if(ub <= cd.ubound){
+			dist = -1;
+			++hits;
+			return true;
+		}
+	}
+
+	++misses;
+	return false;
+}
+
+void DistanceCache::Merge(const string &key, const CachedDistance &cd){
+	pair<unordered_map<string,CachedDistance>::iterator,bool> ins = 
+		entries.insert(make_pair(key, cd));
+
+	if(!ins.second && MoreReusable(cd, ins.first->second)){
+		ins.first->second = cd;
+	}
+}
+
+void DistanceCache::Append(const string &key, const CachedDistance &cd){
+	const unsigned char len = key.size();
+	store.write((const char*)&len, 1);
+	store.write(key.data(), len);
+	store.write((const char*)&cd.dist, sizeof(double));
+	store.write((const char*)&cd.lbound, sizeof(double));
+	store.write((const char*)&cd.ubound, sizeof(double));
+	store.flush();
+
+	if(!store){
+		throw STVException("Error writing to LP result store.");
+	}
+}
+
+void DistanceCache::Store(const Node &node, double upperbound, 
+	double dist, bool timeout){
+	lock_guard<mutex> guard(lock);
+
+	CachedDistance cd;
+	cd.dist = dist;
+	cd.lbound = EffectiveLowerBound(node);
+	cd.ubound = EffectiveUpperBound(node, upperbound);
+	cd.timeout = timeout;
+
+	const string key = DistanceKey(node);
+	Merge(key, cd);
+
+	// Results that timed out are of no use to later runs
+	if(store.is_open() && !timeout){
+		Append(key, cd);
+	}
+}
+
+void DistanceCache::Open(const string &dir, const Ballots &ballots,
+	const Config &config){
+	lock_guard<mutex> guard(lock);
+
+	StoreHeader header;
+	copy(STORE_MAGIC, STORE_MAGIC + 8, header.magic);
+	header.hash = ProfileHash(ballots, config);
+	header.ncandidates = config.ncandidates;
+	header.nballots = ballots.size();
+	header.totalvotes = config.totalvotes;
+
+	stringstream ss;
+	ss << hex << setw(16) << setfill('0') << header.hash << ".lpc";
+
+	try{
+		boost::filesystem::create_directories(dir);
+	}
+	catch(exception &e){
+		throw STVException("Could not create LP result store directory "
+			+ dir + ".");
+	}
+
+	const string path = (boost::filesystem::path(dir) / ss.str()).string();
+
+	if(boost::filesystem::exists(path)){
+		ifstream infile(path.c_str(), ios::binary);
+
+		StoreHeader fheader;
+		infile.read((char*)&fheader, sizeof(StoreHeader));
+
+		if(!infile || !equal(STORE_MAGIC, STORE_MAGIC+8, fheader.magic) ||
+			fheader.hash != header.hash || 
+			fheader.ncandidates != header.ncandidates ||
+			fheader.nballots != header.nballots ||
+			fheader.totalvotes != header.totalvotes){
+			throw STVException("LP result store " + path + 
+				" does not belong to this ballot profile.");
+		}
+
+		// Read records up to the end of the file, or up to a record
+		// left incomplete by an interrupted run.
+		streamoff good = infile.tellg();
+		while(true){
+			unsigned char len = 0;
+			char elim[MAX_TREE_CANDIDATES];
+			CachedDistance cd;
+
+			if(!infile.read((char*)&len, 1) || len == 0 ||
+				len > config.ncandidates || !infile.read(elim, len) ||
+				!infile.read((char*)&cd.dist, sizeof(double)) ||
+				!infile.read((char*)&cd.lbound, sizeof(double)) ||
+				!infile.read((char*)&cd.ubound, sizeof(double))){
+				break;
+			}
+
+			cd.timeout = false;
+			Merge(string(elim, len), cd);
+			++loaded;
+			good = infile.tellg();
+		}
+		infile.close();
+
+		if(good != (streamoff)boost::filesystem::file_size(path)){
+			boost::filesystem::resize_file(path, good);
+		}
+	}
+	else{
+		ofstream outfile(path.c_str(), ios::binary);
+		outfile.write((const char*)&header, sizeof(StoreHeader));
+		if(!outfile){
+			throw STVException("Could not create LP result store " +
+				path + ".");
+		}
+	}
+
+	store.open(path.c_str(), ios::binary | ios::app);
+	if(!store){
+		throw STVException("Could not open LP result store " + path + ".");
+	}
+}
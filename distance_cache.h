@@ -0,0 +1,109 @@
+/*
+    Copyright (C) 2016-2019  Michelle Blom
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _DISTANCE_CACHE_H
+#define _DISTANCE_CACHE_H
+
+#include<string>
+#include<mutex>
+#include<fstream>
+#include<unordered_map>
+#include "model.h"
+
+// Result of solving the 'distance to' LP for an elimination sequence.
+struct CachedDistance{
+	// Value returned by distance() (-1 if the LP was infeasible)
+	double dist;
+
+	// Lower and upper bounds on the objective that the LP was solved with
+	double lbound;
+	double ubound;
+
+	// True if the solver ran out of time, in which case 'dist' is not
+	// the optimal value of the LP.
+	bool timeout;
+};
+
+// Memo of LP results, keyed by the packed elimination sequence of a node.
+// The LP for a node minimises the same objective whatever bounds it is
+// solved with; the bounds only clip its value. A result 'd' solved with
+// bounds [lb, ub] can therefore be reused under new bounds [lb', ub'] as
+// follows:
+//   - if d > lb, d is the true optimum, and max(d, lb') is returned when
+//     it does not exceed ub' (-1, infeasible, otherwise); 
+//   - if d == lb, the optimum is at most lb, and the result is reused 
+//     only when lb' >= lb;
+//   - an infeasible result is reused when ub' <= ub;
+//   - a result that timed out is never reused.
+// The cache may be shared by several threads.
+//
+// If a store directory is opened, results are also appended to a file
+// in that directory named after a hash of the ballot profile, and results
+// recorded there by earlier runs on the same profile are loaded.
+class DistanceCache{
+	private:
+		std::unordered_map<std::string, CachedDistance> entries;
+		long hits;
+		long misses;
+		long loaded;
+
+		std::ofstream store;
+
+		std::mutex lock;
+
+		void Merge(const std::string &key, const CachedDistance &cd);
+		void Append(const std::string &key, const CachedDistance &cd);
+
+	public:
+		DistanceCache() : hits(0), misses(0), loaded(0) {}
+
+		// Load results stored in directory 'dir' for the given profile,
+		// and append all results subsequently stored in the cache to
+		// the same file. The directory is created if it does not exist.
+		// Throws an STVException if the store cannot be read or written,
+		// or belongs to a different profile.
+		void Open(const std::string &dir, const Ballots &ballots,
+			const Config &config);
+
+		// Returns true, and sets 'dist' to the value distance() would
+		// return for 'node' given the current 'upperbound', if a result
+		// for its elimination sequence can be reused.
+		bool Lookup(const Node &node, double upperbound, double &dist);
+
+		// Record the value 'dist' returned by distance() for 'node',
+		// evaluated with the given 'upperbound'.
+		void Store(const Node &node, double upperbound, double dist,
+			bool timeout);
+
+		long Hits() const { return hits; }
+		long Misses() const { return misses; }
+		long Loaded() const { return loaded; }
+		size_t Size() const { return entries.size(); }
+};
+
+// Key under which results for a node are stored: its packed elimination
+// sequence.
+std::string DistanceKey(const Node &node);
+
+// 64-bit hash of a ballot profile (number of candidates, and each
+// ballot's ranking and number of votes). The hash does not depend on the
+// order in which ballots are stored.
+unsigned long long ProfileHash(const Ballots &ballots, 
+	const Config &config);
+
+#endif
@@ -23,11 +23,14 @@
 #include<iostream>
 #include<fstream>
 #include<stdio.h>
+#include<algorithm>
 #include "math.h"
 
 #include "cplex_utils.h"
 #include "irv_distance.h"
 #include "sim_irv.h"
+#include "subset_tally.h"
+#include "prefix_mask.h"
 
 
 using namespace std;
@@ -36,30 +39,111 @@ void ApplyScoringRules(const Ballots &ballots, const Candidates &cand,
 	const Config &config, Node &node){
 
 	try{
+		const BallotStore &store = GetBallotStore(ballots, config);
+
 		// Compute lower bounding rules for partial order
 		int lbound = max(0.0, node.dist);
 
-		if(config.tightbounds){
+		// Both rules count, for each remaining candidate 'e', the votes 
+		// that sit with the first candidate 'c' in the sequence when only
+		// 'e' and some of the candidates in the sequence remain. These are
+		// taken from the subset tally cache if there is one: the basic
+		// rule uses its pairwise counts, and the tight rule either its 
+		// table or one traversal of its trie for all 'e'.
+		// When the tallies' table did not fit in memory, the tight rule
+		// counts with the prefix masks (one mask test per signature 
+		// ranking 'c') rather than by traversing the tallies' trie.
+		const SubsetTallyCache *tallies = config.tallies;
+		if(tallies != NULL && !tallies->Integral()){
+			tallies = NULL;
+		}
+
+		const PrefixMaskSet *masks = config.masks;
+		if(tallies != NULL && masks != NULL && config.tightbounds &&
+			!tallies->Tabulated()){
+			tallies = NULL;
+		}
+
+		if(tallies != NULL){
+			const int c = node.At(0);
+			CandMask seqmask = 0;
+			for(int j = 0; j < node.Size(); ++j){
+				seqmask |= CandMask(1) << node.At(j);
+			}
+
+			Doubles with;
+			if(config.tightbounds && !tallies->Tabulated()){
+				tallies->TalliesWith(seqmask, c, with);
+			}
+
+			int lb = 0;
+			for(int r = 0; r < config.ncandidates; ++r){
+				if(!node.Remaining(r)) continue;
+
+				const Candidate &e = cand[r];
+				int vcntr = 0;
+				if(!config.tightbounds){
+					vcntr = tallies->Above(c, r);
+				}
+				else if(!with.empty()){
+					vcntr = with[r];
+				}
+				else{
+					vcntr = tallies->Tally(seqmask | (CandMask(1) << r), c);
+				}
+
+				int diff = max(0.0, ceil((e.sum_votes - vcntr)/2.0));
+				lb = max(diff, lb);
+			}
+
+			lbound = max(lbound, lb);
+		}
+		else if(masks != NULL){
+			// Count with one mask test per ballot ranking the first
+			// candidate 'c' in the sequence: the tight rule blocks 'e' and
+			// the rest of the sequence, the basic rule only 'e'.
+			const PrefixMasks &cmasks = masks->For(node.At(0));
+			CandMask block = 0;
+			if(config.tightbounds){
+				for(int j = 1; j < node.Size(); ++j){
+					block |= CandMask(1) << node.At(j);
+				}
+			}
+
+			int lb = 0;
+			for(int r = 0; r < config.ncandidates; ++r){
+				if(!node.Remaining(r)) continue;
+
+				const Candidate &e = cand[r];
+				const int vcntr = cmasks.Count(block | (CandMask(1) << r));
+
+				int diff = max(0.0, ceil((e.sum_votes - vcntr)/2.0));
+				lb = max(diff, lb);
+			}
+
+			lbound = max(lbound, lb);
+		}
+		else if(config.tightbounds){
 			// Tighter lower bound
 			int lb2 = 0;
 
 			Ints alive(config.ncandidates, 0);
-			for(int j = 0; j < node.order_c.size(); ++j){
-				alive[node.order_c[j]] = 1;
+			for(int j = 0; j < node.Size(); ++j){
+				alive[node.At(j)] = 1;
 			}
 		
-			for(SInts::const_iterator it = node.remcand.begin();
-				it != node.remcand.end(); ++it){
-				const Candidate &e = cand[*it];
-				const Candidate &c = cand[node.order_c[0]];
+			for(int r = 0; r < config.ncandidates; ++r){
+				if(!node.Remaining(r)) continue;
+
+				const Candidate &e = cand[r];
+				const Candidate &c = cand[node.At(0)];
 				int vcntr = 0;
 
-				for(Ballots::const_iterator bt = ballots.begin();
-					bt != ballots.end(); ++bt){
-					for(Ints::const_iterator jt = bt->prefs.begin();
-						jt != bt->prefs.end(); ++jt){
+				for(int b = 0; b < store.Size(); ++b){
+					for(const Pref *jt = store.Begin(b); 
+						jt != store.End(b); ++jt){
 						if(*jt == c.index){
-							vcntr += bt->votes;
+							vcntr += store.votes[b];
 							break;
 						}
 						else if(*jt == e.index){
@@ -79,9 +163,10 @@ void ApplyScoringRules(const Ballots &ballots, const Candidates &cand,
 		}
 		else{
 			int lb1 = 0;
-			for(SInts::const_iterator it = node.remcand.begin();
-				it != node.remcand.end(); ++it){
-				const Candidate &e = cand[*it];
+			for(int r = 0; r < config.ncandidates; ++r){
+				if(!node.Remaining(r)) continue;
+
+				const Candidate &e = cand[r];
 				// 'e' must be eliminated before candidates
 				// currently in node.elim_seq.
 
@@ -92,15 +177,14 @@ void ApplyScoringRules(const Ballots &ballots, const Candidates &cand,
 				// computed the lower bound as each candidate was added
 				// to the tree, so we only need to focus on the first 
 				// candidate in the partial order.
-				const Candidate &c = cand[node.order_c[0]];
+				const Candidate &c = cand[node.At(0)];
 				int vcntr = 0;
 
-				for(Ballots::const_iterator bt = ballots.begin();
-					bt != ballots.end(); ++bt){
-					for(Ints::const_iterator jt = bt->prefs.begin();
-						jt != bt->prefs.end(); ++jt){
+				for(int b = 0; b < store.Size(); ++b){
+					for(const Pref *jt = store.Begin(b); 
+						jt != store.End(b); ++jt){
 						if(*jt == c.index){
-							vcntr += bt->votes;
+							vcntr += store.votes[b];
 							break;
 						}
 						else if(*jt == e.index){
@@ -128,75 +212,154 @@ void ApplyScoringRules(const Ballots &ballots, const Candidates &cand,
 
 
 
-int next_mod(vector<int> &mask, int n){
-	int i;
-	for(i = 0; i < n && mask[i]; ++i){
-		mask[i] = 0;
-	}
+void ApplyScoringRules(const Ballots &ballots, const Candidates &cand,
+	const Config &config, const Node &parent, vector<Node> &children){
 
-	if(i < n){
-		mask[i] = 1;
-		return 1;
-	}
-	return 0;
-}
+	try{
+		const int ncand = config.ncandidates;
 
+		// The child that prepends 'c' to the sequence of 'parent' needs, 
+		// for each of its remaining candidates 'e', the votes in which 'c'
+		// is ranked above 'e' and (for the tight rule) above all 
+		// candidates in the parent's sequence: counts[c*ncand + e].
+		CandMask stop = 0;
+		if(config.tightbounds){
+			for(int j = 0; j < parent.Size(); ++j){
+				stop |= CandMask(1) << parent.At(j);
+			}
+		}
 
-void CreateEquivalenceClasses(const Ballots &ballots, 
-	const Candidates &cand, const Config &config, Node &node,
-	const Ints &position){
-	try{
-		const int ncand = node.order_c.size();
+		const SubsetTallyCache *tallies = config.tallies;
+		if(tallies != NULL && !tallies->Integral()){
+			tallies = NULL;
+		}
 
-		Ints mask(config.ncandidates, 0);
+		if(tallies != NULL && (!config.tightbounds || tallies->Tabulated())){
+			// Counts are lookups in the subset tally cache
+			for(int i = 0; i < children.size(); ++i){
+				ApplyScoringRules(ballots, cand, config, children[i]);
+			}
+			return;
+		}
 
-		int cntr = 0;
-		while(next_mod(mask, ncand)){
-			int j = -1;
-			for(int i = 0; i < ncand; ++i){
-				if(mask[i]){
-					j = i;
-					break;
+		Ints counts(ncand * ncand, 0);
+		if(config.masks != NULL){
+			// One mask test per signature ranking the child's first
+			// candidate, for each of the child's remaining candidates
+			for(int i = 0; i < children.size(); ++i){
+				const Node &child = children[i];
+				const PrefixMasks &cmasks = config.masks->For(child.At(0));
+				int *row = &counts[child.At(0) * ncand];
+				for(int r = 0; r < ncand; ++r){
+					if(!child.Remaining(r)) continue;
+					row[r] = cmasks.Count(stop | (CandMask(1) << r));
+				}
+			}
+		}
+		else if(tallies != NULL){
+			Doubles within;
+			tallies->AboveWithin(stop, within);
+			for(int i = 0; i < within.size(); ++i){
+				counts[i] = within[i];
+			}
+		}
+		else{
+			// One pass over the ballots. Counts are accumulated ballot by
+			// ballot into integers, as in the rules for a single node, so 
+			// that they are the same for fractional vote weights. 'open' 
+			// is 1 for candidates not yet seen on the current ballot.
+			const BallotStore &store = GetBallotStore(ballots, config);
+			Doubles open(ncand);
+			for(int b = 0; b < store.Size(); ++b){
+				fill(open.begin(), open.end(), 1.0);
+				const double votes = store.votes[b];
+
+				for(const Pref *jt = store.Begin(b); 
+					jt != store.End(b); ++jt){
+					if((stop >> *jt) & 1) break;
+
+					open[*jt] = 0;
+					int *row = &counts[*jt * ncand];
+					for(int e = 0; e < ncand; ++e){
+						row[e] = row[e] + votes*open[e];
+					}
 				}
 			}
+		}
 
-			if(j < 0) continue;
-	
-			vector<int> key(ncand, 0);
-			for(int i = 0; i < ncand; ++i){
-				if(mask[i])
-					key[i] = 1;
+		for(int i = 0; i < children.size(); ++i){
+			Node &child = children[i];
+			const int *row = &counts[child.At(0) * ncand];
+
+			int lbound = max(0.0, child.dist);
+			for(int r = 0; r < ncand; ++r){
+				if(!child.Remaining(r)) continue;
+
+				const Candidate &e = cand[r];
+				int diff = max(0.0, ceil((e.sum_votes - row[r])/2.0));
+				lbound = max(diff, lbound);
 			}
 
-			Ballot b;
-			b.tag = cntr++;
-			b.votes = 0;
+			child.dist = lbound;
+		}
+	}
+	catch(const exception &e){
+		throw;
+	}
+	catch(const STVException &e){
+		throw;
+	}
+	catch(...){
+		throw STVException("Unexpected error in ApplyScoringRules");
+	}
+}
 
-			b.prefs.push_back(node.order_c[j]);
-			for(int i = j+1; i < ncand; ++i){
-				if(mask[i]){
-					b.prefs.push_back(node.order_c[i]);
+
+void CreateEquivalenceClasses(const Ballots &ballots, 
+	const Candidates &cand, const Config &config, DistanceScratch &scratch){
+	try{
+		const Ints &order_c = scratch.order_c;
+		const Ints &position = scratch.position;
+		const int ncand = order_c.size();
+
+		scratch.classes.Reset(ncand, config.sparseclasses);
+
+		// A class for every non-empty subset of the sequence, with the
+		// class for mask 'm' given tag m - 1, unless only classes that
+		// occur are wanted.
+		const CandMask nclasses = config.sparseclasses ? 1 :
+			CandMask(1) << ncand;
+		scratch.rev_ballots.resize(nclasses - 1);
+
+		for(CandMask mask = 1; mask < nclasses; ++mask){
+			Ballot &b = scratch.rev_ballots[mask - 1];
+			b.tag = mask - 1;
+			b.votes = 0;
+			b.prefs.clear();
+			for(int i = 0; i < ncand; ++i){
+				if((mask >> i) & 1){
+					b.prefs.push_back(order_c[i]);
 				}
 			}
 
-			node.rev_ballots.push_back(b);
-			node.ballotmap.insert(pair<vector<int>,int>(key, b.tag));
+			scratch.classes.Insert(mask, b.tag);
 		}
 
-		for(int b = 0; b < ballots.size(); ++b){
-			const Ballot &bt = ballots[b];
-			Ints key;
-			key.resize(ncand, 0);
+		const BallotStore &store = GetBallotStore(ballots, config);
+		scratch.bid2newid.resize(store.Size());
+
+		for(int b = 0; b < store.Size(); ++b){
+			CandMask key = 0;
 
 			int maxj = 0;
-			for(int i = 0; i < bt.prefs.size(); ++i){
-				int j = position[bt.prefs[i]];
+			for(const Pref *it = store.Begin(b); it != store.End(b); ++it){
+				int j = position[*it];
 
 				if(j == -1)
 					continue;
 
 				if(j >= maxj){
-					key[j] = 1;
+					key |= CandMask(1) << j;
 					maxj = j;
 
 					if(j == ncand - 1){
@@ -204,15 +367,28 @@ void CreateEquivalenceClasses(const Ballots &ballots,
 					}
 				}
 			}
-	
-			if(node.ballotmap.find(key) == node.ballotmap.end()){
-				node.bid2newid[b] = -1;
-				continue;
+
+			int id = (key == 0) ? -1 : scratch.classes.Find(key);
+			if(id == -1 && key != 0){
+				// First ballot in a class (sparse classes only)
+				Ballot nb;
+				nb.tag = scratch.rev_ballots.size();
+				nb.votes = 0;
+				for(int i = 0; i < ncand; ++i){
+					if((key >> i) & 1){
+						nb.prefs.push_back(order_c[i]);
+					}
+				}
+
+				scratch.rev_ballots.push_back(nb);
+				scratch.classes.Insert(key, nb.tag);
+				id = nb.tag;
+			}
+
+			scratch.bid2newid[b] = id;
+			if(id != -1){
+				scratch.rev_ballots[id].votes += store.votes[b];
 			}
-		
-			int id = node.ballotmap.find(key)->second;
-			node.rev_ballots[id].votes += bt.votes;
-			node.bid2newid[b] = id;
 		}
 	}
 	catch(STVException &e)
@@ -226,135 +402,497 @@ void CreateEquivalenceClasses(const Ballots &ballots,
 }
 
 
-double distance(const Ballots &ballots, const Candidates &cand, 
-	const Config &config, Node &node, double upperbound,
-	double tleft, ofstream &log, bool dolog, bool &timeout){
+// Compute the projection of the ballots onto the sequence order_c[1..],
+// that of the parent of the node being evaluated (see DistanceScratch).
+void ProjectParent(const Ballots &ballots, const Config &config, 
+	DistanceScratch &scratch){
+	try{
+		const Ints &order_c = scratch.order_c;
+		const Ints &position = scratch.position;
+		const int k = order_c.size() - 1;
+
+		scratch.parent_order.assign(order_c.begin()+1, order_c.end());
+		scratch.parent_remidx.assign(config.ncandidates, -1);
+		int nrem = 0;
+		for(int c = 0; c < config.ncandidates; ++c){
+			if(position[c] < 1){
+				scratch.parent_remidx[c] = nrem++;
+			}
+		}
+		scratch.parent_nrem = nrem;
 
-	double dist = -1;
+		const size_t nclasses = size_t(1) << k;
+		scratch.parent_above.assign(nclasses * nrem, 0);
+		scratch.parent_below.assign(nclasses * nrem, 0);
+
+		const BallotStore &store = GetBallotStore(ballots, config);
+		Ints before(nrem, 0);
+
+		for(int b = 0; b < store.Size(); ++b){
+			// Class of the ballot (as in CreateEquivalenceClasses, with
+			// positions in the parent's sequence), and the candidates 
+			// outside the sequence that it ranks before any in it.
+			fill(before.begin(), before.end(), 0);
+			size_t m = 0;
+			int maxj = 0;
+			for(const Pref *it = store.Begin(b); it != store.End(b); ++it){
+				const int j = position[*it] - 1;
+
+				if(j < 0){
+					if(m == 0) before[scratch.parent_remidx[*it]] = 1;
+					continue;
+				}
+
+				if(j >= maxj){
+					m |= size_t(1) << j;
+					maxj = j;
+
+					if(j == k - 1){
+						break;
+					}
+				}
+			}
+
+			const double votes = store.votes[b];
+			double *above = &scratch.parent_above[m * nrem];
+			double *below = &scratch.parent_below[m * nrem];
+			for(int r = 0; r < nrem; ++r){
+				if(before[r]){
+					above[r] += votes;
+				}
+				else{
+					below[r] += votes;
+				}
+			}
+		}
+	}
+	catch(STVException &e)
+	{
+		throw e;
+	}
+	catch(...)
+	{
+		throw STVException("Unexpected error in projecting parent.");
+	}
+}
 
+// Derive the equivalence classes of the node being evaluated from the 
+// projection of its parent. Adding order_c[0] to the front of the parent's
+// sequence splits each parent class 'm' in two: ballots ranking order_c[0]
+// above the parent's sequence form class (m << 1) | 1, and the rest class
+// m << 1. Classes are created in the same order, with the same tags, as
+// in CreateEquivalenceClasses, and each ballot's votes are added in the
+// same order.
+void DeriveEquivalenceClasses(DistanceScratch &scratch){
 	try{
-		const int ncand = node.order_c.size();	
-		Ints position(config.ncandidates, -1);
+		const Ints &order_c = scratch.order_c;
+		const int ncand = order_c.size();
+		const int nrem = scratch.parent_nrem;
+		const int r = scratch.parent_remidx[order_c[0]];
+
+		const size_t nclasses = size_t(1) << ncand;
+		scratch.rev_ballots.resize(nclasses - 1);
+
+		for(size_t mask = 1; mask < nclasses; ++mask){
+			Ballot &b = scratch.rev_ballots[mask - 1];
+			b.tag = mask - 1;
+			b.prefs.clear();
+			for(int i = 0; i < ncand; ++i){
+				if((mask >> i) & 1){
+					b.prefs.push_back(order_c[i]);
+				}
+			}
 
-		for(int i = 0; i < node.order_c.size(); ++i){
-			position[node.order_c[i]] = i;
+			const size_t m = mask >> 1;
+			b.votes = (mask & 1) ? scratch.parent_above[m * nrem + r] :
+				scratch.parent_below[m * nrem + r];
 		}
+	}
+	catch(STVException &e)
+	{
+		throw e;
+	}
+	catch(...)
+	{
+		throw STVException("Unexpected error in deriving eq classes.");
+	}
+}
 
-		CreateEquivalenceClasses(ballots, cand, config, node, position);
 
-		IloEnv env;
-		IloModel cmodel(env);
+// Variables and constraints of an LP for a node. Those that depend on the
+// node's data rather than the structure of its sequence (the sizes of its
+// classes and the bounds on the objective and variables) are set by 
+// SetLPData, so that a model can be reused for other sequences of the
+// same length.
+struct LPModel{
+	IloModel model;
+	IloCplex cplex;
 
-		// Assume ballots contains all possible rankings, even 
-		// if the number of times that ranking was voted for is '0'
-		const int sigs = node.rev_ballots.size();
+	IloNumVarArray ps;
+	IloNumVarArray ms;
+	IloNumVarArray ys;
 
-		IloNumVarArray ps(env, sigs);
-		IloNumVarArray ms(env, sigs);
-		IloNumVarArray ys(env, sigs);
+	// Flow variables for new ballots (sparse classes only)
+	IloNumVarArray flowvars;
 
-		char varname[500];
+	// n_s == y_s + m_s - p_s for each class 's'
+	IloRangeArray sizes;
 
-		IloExpr balance(env);
+	// lb <= objective <= ub
+	IloRange objrange;
+};
 
-		double lb = max(0.0, node.dist);
-		double ub = max(lb, upperbound);
+struct LPModels{
+	IloEnv env;
 
-		IloExpr obj(env);
+	// Model for sequences of each length (an empty handle if none has 
+	// been built yet).
+	vector<LPModel> depth;
 
-		for(int i = 0; i < sigs; ++i){
-			const double ns = node.rev_ballots[i].votes;
+	~LPModels(){
+		env.end();
+	}
+};
+
+DistanceScratch::DistanceScratch() : parent_nrem(0), buildtime(0), 
+	solvetime(0) {}
+
+DistanceScratch::~DistanceScratch() {}
+
+// Create the LP for the sequence and equivalence classes in 'scratch'
+// (with all data zero) in 'env'.
+void BuildLP(IloEnv env, const Config &config, 
+	const DistanceScratch &scratch, LPModel &lp){
+	const Ints &order_c = scratch.order_c;
+	const Ints &position = scratch.position;
+	const int ncand = order_c.size();
+	const int sigs = scratch.rev_ballots.size();
+
+	IloModel cmodel(env);
+	lp.model = cmodel;
+
+	// Assume ballots contains all possible rankings, even 
+	// if the number of times that ranking was voted for is '0'
+	// (unless config.sparseclasses is set, see below).
+	IloNumVarArray ps(env, sigs);
+	IloNumVarArray ms(env, sigs);
+	IloNumVarArray ys(env, sigs);
+	IloRangeArray sizes(env, sigs);
+
+	// Variables are only named when debugging, as formatting names is a
+	// noticeable part of the cost of building an LP.
+	char varname[500];
+	const char *name = config.debug ? varname : NULL;
+	const IloNumVar::Type vtype = (ncand == config.ncandidates) ?
+		ILOINT : ILOFLOAT;
+
+	IloExpr balance(env);
+	IloExpr obj(env);
+
+	for(int i = 0; i < sigs; ++i){
+		// p_s variable: number of ballots modified so that their
+		// new signature is 's' 
+		if(name) sprintf(varname, "vps_%d", i);
+		ps[i] = IloNumVar(env, 0, IloInfinity, vtype, name);
+
+		// m_s variable: number of ballots whose signature in the
+		// original profile is 's', but are modified to something 
+		// other than 's' in the new profile
+		if(name) sprintf(varname, "vms_%d", i);
+	    ms[i] = IloNumVar(env, 0, IloInfinity, vtype, name);
+
+		// y_s variable: total number of ballots with signature 's'
+		// in the new election profile
+		if(name) sprintf(varname, "vys_%d", i);
+		ys[i] = IloNumVar(env, 0, IloInfinity, ILOFLOAT, name);
+
+		// n_s = total number of ballots with signature 's' in
+		// the original profile.
+		// constraint: n_s + p_s - m_s = y_s
+		//     rewrite: n_s = y_s + m_s - p_s
+		sizes[i] = IloRange(env, 0, ys[i] + ms[i] - ps[i], 0);
+		balance += (ps[i] - ms[i]);
+
+		obj += ps[i];
+	}
+	cmodel.add(sizes);
+
+	// With sparse classes, only classes that occur in the profile have
+	// variables. A new ballot may belong to any class, however, so new
+	// ballots are modelled as flows over the positions 0..ncand-1 of 
+	// the sequence: a ballot ranking the candidates at positions
+	// q1 < q2 < ... < qn starts at q1 (counting toward that candidate 
+	// until it is eliminated in round q1), moves to q2, and so on, and
+	// ends at qn. starts[q] is the number of new ballots starting at 
+	// position 'q', moves[q][r] (r > q) the number moving from 'q' to 
+	// 'r', and ends[q] the number ending at 'q'. Any flow decomposes 
+	// into ballots (integral flows into whole ballots), and any set of
+	// new ballots gives a flow, so the LP has the same optimum as one
+	// with variables for every class. New ballots count toward the 
+	// candidate at position 'q' in round 'r' <= q if they start at 'q',
+	// or move to 'q' from a position before 'r'.
+	const bool flows = config.sparseclasses;
+
+	IloNumVarArray flowvars(env);
+	IloNumVarArray starts(env, flows ? ncand : 0);
+	IloNumVarArray ends(env, flows ? ncand : 0);
+	vector<IloNumVarArray> moves;
+
+	for(int q = 0; flows && q < ncand; ++q){
+		if(name) sprintf(varname, "vst_%d", q);
+		starts[q] = IloNumVar(env, 0, IloInfinity, vtype, name);
+		if(name) sprintf(varname, "ven_%d", q);
+		ends[q] = IloNumVar(env, 0, IloInfinity, vtype, name);
+		flowvars.add(starts[q]);
+		flowvars.add(ends[q]);
+
+		moves.push_back(IloNumVarArray(env, ncand));
+		for(int r = q+1; r < ncand; ++r){
+			if(name) sprintf(varname, "vmv_%d_%d", q, r);
+			moves[q][r] = IloNumVar(env, 0, IloInfinity, vtype, name);
+			flowvars.add(moves[q][r]);
+		}
+	}
+
+	for(int q = 0; flows && q < ncand; ++q){
+		IloExpr in(env);
+		IloExpr out(env);
+		in += starts[q];
+		for(int r = 0; r < q; ++r){
+			in += moves[r][q];
+		}
+		out += ends[q];
+		for(int r = q+1; r < ncand; ++r){
+			out += moves[q][r];
+		}
+		cmodel.add(in == out);
+		in.end();
+		out.end();
+
+		balance += starts[q];
+		obj += starts[q];
+	}
+
+	lp.objrange = IloRange(env, 0, obj, IloInfinity);
+	cmodel.add(lp.objrange);
+	cmodel.add(IloMinimize(env, obj));
+
+	cmodel.add(balance == 0);
+	balance.end();
+	obj.end();
+
+	// Constraints to ensure elimination order proceeds as stated
+	for(int round = 0; round < ncand-1; ++round){
+		// The candidate 'ec' eliminated in this round must have less than
+		// (or equal to) votes than everyone still remaining.
+		IloExpr yr(env); // Votes in tally of 'e'
+
+		const int ec = order_c[round];
+
+		Ints2d poss_tally(config.ncandidates);
+
+		if(flows){
+			yr += starts[round];
+			for(int q = 0; q < round; ++q){
+				yr += moves[q][round];
+			}
+		}
 
-			// p_s variable: number of ballots modified so that their
-			// new signature is 's' 
-			sprintf(varname, "vps_%d", i);
-			if(ncand == config.ncandidates){
-				ps[i] = IloNumVar(env, 0, ub, ILOINT, varname);
+		for(int i = 0; i < sigs; ++i){
+			// will this ballot signature count toward 'ec'
+			const Ballot &bt = scratch.rev_ballots[i];
+			for(int j = 0; j < bt.prefs.size(); ++j){
+				if(bt.prefs[j] == ec){
+					yr += ys[i];
+					break;
+				}
+				else if(position[bt.prefs[j]] > round){
+					// Ballot with name 'i' will be in bt.prefs[j]'s tally
+					poss_tally[bt.prefs[j]].push_back(i);
+					break;
+				} 
 			}
-			else{
-				ps[i] = IloNumVar(env, 0, ub, ILOFLOAT, varname);
+		} 
+
+		for(int j = round+1; j < ncand; ++j){
+			// How many votes does the candidate eliminated in position
+			// 'j' have right now?
+			const int cc = order_c[j];
+
+			IloExpr yr_cc(env);
+			const Ints &intally = poss_tally[cc];
+
+			for(int k = 0; k < intally.size(); ++k){
+				yr_cc += ys[intally[k]];
 			}
 
-			// m_s variable: number of ballots whose signature in the
-			// original profile is 's', but are modified to something 
-			// other than 's' in the new profile
-			sprintf(varname, "vms_%d", i);
-			if(ncand == config.ncandidates){
-		    	ms[i] = IloNumVar(env, 0, min(ns, ub), ILOINT, varname);
+			if(flows){
+				yr_cc += starts[j];
+				for(int q = 0; q < round; ++q){
+					yr_cc += moves[q][j];
+				}
 			}
-			else{
-		    	ms[i] = IloNumVar(env, 0, min(ns, ub), ILOFLOAT, varname);
+
+			if(intally.size() > 0 || flows){
+				cmodel.add(yr <= yr_cc);
 			}
+			yr_cc.end();
+		}
+		yr.end();
+	}
 
-			// y_s variable: total number of ballots with signature 's'
-			// in the new election profile
-			sprintf(varname, "vys_%d", i);
+	starts.end();
+	ends.end();
+	for(int q = 0; q < moves.size(); ++q){
+		moves[q].end();
+	}
+
+	lp.ps = ps;
+	lp.ms = ms;
+	lp.ys = ys;
+	lp.flowvars = flowvars;
+	lp.sizes = sizes;
+
+	lp.cplex = IloCplex(cmodel);
+	lp.cplex.setWarning(env.getNullStream());
+	if(config.nthreads > 1){
+		// Nodes are already being evaluated in parallel
+		lp.cplex.setParam(IloCplex::Threads, 1);
+	}
+}
 
-			ys[i] = IloNumVar(env, 0, min(ns+ub,config.totalvotes), 
-			    ILOFLOAT, varname);
+// End everything created by BuildLP for 'lp'.
+void EndLP(LPModel &lp){
+	lp.cplex.end();
+	EndModel(lp.model);
+
+	lp.ps.endElements();
+	lp.ps.end();
+	lp.ms.endElements();
+	lp.ms.end();
+	lp.ys.endElements();
+	lp.ys.end();
+	lp.flowvars.endElements();
+	lp.flowvars.end();
+	lp.sizes.end();
+}
 
-			// n_s = total number of ballots with signature 's' in
-			// the original profile.
-			// constraint: n_s + p_s - m_s = y_s
-			//     rewrite: n_s = y_s + m_s - p_s
-			cmodel.add(ns == ys[i] + ms[i] - ps[i]);
-			balance += (ps[i] - ms[i]);
+// Set the class sizes (from the equivalence classes in 'scratch') and 
+// bounds of an LP built by BuildLP, for objective values in [lb, ub].
+void SetLPData(IloEnv env, const Config &config, 
+	const DistanceScratch &scratch, double lb, double ub, LPModel &lp){
+	const int sigs = scratch.rev_ballots.size();
+
+	IloNumArray ns(env, sigs);
+	IloNumArray zero(env, sigs);
+	IloNumArray pub(env, sigs);
+	IloNumArray mub(env, sigs);
+	IloNumArray yub(env, sigs);
+
+	for(int i = 0; i < sigs; ++i){
+		ns[i] = scratch.rev_ballots[i].votes;
+		zero[i] = 0;
+		pub[i] = ub;
+		mub[i] = min(ns[i], ub);
+		yub[i] = min(ns[i] + ub, config.totalvotes);
+	}
 
-			obj += ps[i];
+	lp.sizes.setBounds(ns, ns);
+	lp.ps.setBounds(zero, pub);
+	lp.ms.setBounds(zero, mub);
+	lp.ys.setBounds(zero, yub);
+	lp.objrange.setBounds(lb, ub);
+
+	const int nflows = lp.flowvars.getSize();
+	if(nflows > 0){
+		IloNumArray fzero(env, nflows);
+		IloNumArray fub(env, nflows);
+		for(int i = 0; i < nflows; ++i){
+			fzero[i] = 0;
+			fub[i] = ub;
 		}
+		lp.flowvars.setBounds(fzero, fub);
+		fzero.end();
+		fub.end();
+	}
+
+	ns.end();
+	zero.end();
+	pub.end();
+	mub.end();
+	yub.end();
+}
+
+
+double distance(const Ballots &ballots, const Candidates &cand, 
+	const Config &config, Node &node, double upperbound,
+	double tleft, ofstream &log, bool dolog, bool &timeout,
+	DistanceScratch &scratch){
 
-		cmodel.add(obj >= lb);
-		cmodel.add(obj <= ub);
-		cmodel.add(IloMinimize(env, obj));
+	double dist = -1;
 
-		cmodel.add(balance == 0);
+	try{
+		mytimespec tstart;
+		GetTime(&tstart);
 
-		// Constraints to ensure elimination order proceeds as stated
-		for(int round = 0; round < ncand-1; ++round){
-			// The candidate 'ec' eliminated in this round must have less than
-			// (or equal to) votes than everyone still remaining.
-			IloExpr yr(env); // Votes in tally of 'e'
+		Ints &order_c = scratch.order_c;
+		Ints &position = scratch.position;
 
-			const int ec = node.order_c[round];
+		node.GetOrder(order_c);
+		const int ncand = order_c.size();	
 
-			Ints2d poss_tally(config.ncandidates);
+		position.assign(config.ncandidates, -1);
+		for(int i = 0; i < order_c.size(); ++i){
+			position[order_c[i]] = i;
+		}
 
-			for(int i = 0; i < sigs; ++i){
-				// will this ballot signature count toward 'ec'
-				const Ballot &bt = node.rev_ballots[i];
-				for(int j = 0; j < bt.prefs.size(); ++j){
-					if(bt.prefs[j] == ec){
-						yr += ys[i];
-						break;
-					}
-					else if(position[bt.prefs[j]] > round){
-						// Ballot with name 'i' will be in bt.prefs[j]'s tally
-						poss_tally[bt.prefs[j]].push_back(i);
-						break;
-					} 
-				}
-			} 
+		scratch.ClearEqClassData();
+		if(ncand > 1 && !config.sparseclasses){
+			// Siblings share a parent, whose projection is kept for them
+			if(scratch.parent_order.size() != ncand - 1 ||
+				!equal(order_c.begin()+1, order_c.end(), 
+				scratch.parent_order.begin())){
+				ProjectParent(ballots, config, scratch);
+			}
+			DeriveEquivalenceClasses(scratch);
+		}
+		else{
+			CreateEquivalenceClasses(ballots, cand, config, scratch);
+		}
 
-			for(int j = round+1; j < ncand; ++j){
-				// How many votes does the candidate eliminated in position
-				// 'j' have right now?
-				const int cc = node.order_c[j];
+		const double lb = max(0.0, node.dist);
+		const double ub = max(lb, upperbound);
 
-				IloExpr yr_cc(env);
-				const Ints &intally = poss_tally[cc];
+		// The model for this length of sequence is reused. With sparse
+		// classes, a model is built for each node (in an environment from
+		// the pool).
+		const bool reuse = !config.sparseclasses;
+		if(reuse && !scratch.models){
+			scratch.models.reset(new LPModels());
+		}
 
-				for(int k = 0; k < intally.size(); ++k){
-					yr_cc += ys[intally[k]];
-				}
+		unique_ptr<PooledEnv> pooled;
+		if(!reuse){
+			pooled.reset(new PooledEnv());
+		}
 
-				if(intally.size() > 0){
-					cmodel.add(yr <= yr_cc);
-				}
+		IloEnv env = reuse ? scratch.models->env : pooled->Env();
+		LPModel fresh;
+		LPModel *lp = &fresh;
+		if(reuse){
+			vector<LPModel> &depth = scratch.models->depth;
+			if(depth.size() <= ncand){
+				depth.resize(ncand + 1);
 			}
+			lp = &depth[ncand];
 		}
-		
 
-		IloCplex cplex(cmodel);
+		if(lp->model.getImpl() == NULL){
+			BuildLP(env, config, scratch, *lp);
+		}
+		SetLPData(env, config, scratch, lb, ub, *lp);
+
+		IloCplex &cplex = lp->cplex;
 		if(dolog && config.optlog){
 			cplex.setOut(log);
 		}
@@ -362,12 +900,15 @@ double distance(const Ballots &ballots, const Candidates &cand,
 			cplex.setOut(env.getNullStream());
 		}
 
-		cplex.setWarning(env.getNullStream());
-		if(tleft >= 0){
-        	cplex.setParam(IloCplex::TiLim, tleft);
-		}
+		// (1e+75 is the CPLEX default, i.e. no limit)
+		cplex.setParam(IloCplex::TiLim, tleft >= 0 ? tleft : 1e+75);
+
+		scratch.ClearEqClassData();
+
+		mytimespec tbuilt;
+		GetTime(&tbuilt);
+		scratch.buildtime += tbuilt.seconds - tstart.seconds;
 
-		node.ClearEqClassData();
 		bool result = cplex.solve();
 
 		if(cplex.getCplexStatus() == IloCplex::Infeasible){
@@ -381,10 +922,14 @@ double distance(const Ballots &ballots, const Candidates &cand,
 			dist = cplex.getObjValue();
 		}
 
-		cplex.end();
-		cmodel.end();
-		env.end();
+		mytimespec tsolved;
+		GetTime(&tsolved);
+		scratch.solvetime += tsolved.seconds - tbuilt.seconds;
 
+		if(!reuse){
+			EndLP(fresh);
+			pooled->Release();
+		}
 	}
 	catch(IloCplex::Exception e){
 		stringstream ss;
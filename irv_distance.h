@@ -19,8 +19,109 @@
 #ifndef _STV_DISTANCE_H
 #define _STV_DISTANCE_H
 
+#include<unordered_map>
+#include<memory>
 #include "model.h"
 
+// Equivalence classes are identified by a bitmask of the positions, in the
+// elimination sequence of the node, of the candidates they contain. For
+// sequences of up to DENSE_CLASS_BITS candidates, masks index a flat array 
+// of class ids; longer sequences, and sparse sets of classes (only those 
+// that occur in the profile), use a hash table.
+#define DENSE_CLASS_BITS 24
+
+struct ClassIndex{
+	bool isdense;
+	Ints dense;
+	std::unordered_map<CandMask,int> sparse;
+
+	ClassIndex() : isdense(true) {}
+
+	// Remove all classes, for sequences of 'nbits' candidates. Storage is
+	// reused from one sequence to the next.
+	void Reset(int nbits, bool sparseclasses){
+		isdense = (!sparseclasses && nbits <= DENSE_CLASS_BITS);
+		sparse.clear();
+		if(isdense){
+			dense.assign(size_t(1) << nbits, -1);
+		}
+	}
+
+	void Insert(CandMask mask, int id){
+		if(isdense){
+			dense[mask] = id;
+		}
+		else{
+			sparse[mask] = id;
+		}
+	}
+
+	// Id of the class with the given mask, or -1 if there is none.
+	int Find(CandMask mask) const{
+		if(isdense){
+			return dense[mask];
+		}
+		std::unordered_map<CandMask,int>::const_iterator it = 
+			sparse.find(mask);
+		return (it == sparse.end()) ? -1 : it->second;
+	}
+};
+
+// CPLEX models kept by a DistanceScratch (see irv_distance.cpp)
+struct LPModels;
+
+// Data used while solving the LP for a node: the elimination sequence of
+// the node and the equivalence classes of ballots it induces. This is kept
+// out of Node so that nodes waiting in the fringe stay small; each thread
+// evaluating nodes keeps one DistanceScratch and reuses it for every LP.
+struct DistanceScratch{
+	// Elimination sequence of the node being evaluated, and the position
+	// of each candidate in it (-1 if not present).
+	Ints order_c;
+	Ints position;
+
+	// Equivalence classes of the node, and the class of each ballot 
+	// signature (-1 if it ranks none of the node's candidates).
+	Ballots rev_ballots;
+	ClassIndex classes;
+	Ints bid2newid;
+
+	// Projection of the ballots onto the sequence of the node whose 
+	// children are being evaluated (the node's sequence without its first
+	// candidate), from which the equivalence classes of each child are
+	// derived. A class 'm' of the parent has bit i set if the i'th 
+	// candidate in its sequence is in the class (m = 0 for ballots ranking
+	// none of them). For each candidate 'c' not in the sequence, with index
+	// r = parent_remidx[c], parent_above[m*parent_nrem + r] is the number
+	// of votes of ballots in class 'm' that rank 'c' above every candidate
+	// in the sequence, and parent_below those that do not. The projection
+	// is kept until a node with a different parent is evaluated.
+	Ints parent_order;
+	Ints parent_remidx;
+	int parent_nrem;
+	Doubles parent_above;
+	Doubles parent_below;
+
+	// LP models reused from one node to the next. Without sparse classes,
+	// the LP for a sequence of k candidates differs from that for any 
+	// other sequence of k candidates only in the sizes of its classes and
+	// its bounds, so one model is kept for each sequence length and 
+	// updated in place, and CPLEX starts from the last basis found for it.
+	std::unique_ptr<LPModels> models;
+
+	// Time (in seconds) spent building LPs (forming equivalence classes
+	// and creating or updating models) and solving them.
+	double buildtime;
+	double solvetime;
+
+	DistanceScratch();
+	~DistanceScratch();
+
+	void ClearEqClassData(){
+		rev_ballots.clear();
+	}
+};
+
 // Apply basic or tight scoring rules to evaluate a partial (or total)
 // elimination sequence prior to solving an LP for it.
 //
@@ -36,6 +137,24 @@
 void ApplyScoringRules(const Ballots &ballots, const Candidates &cand,
 	const Config &config, Node &node);
 
+// Apply the scoring rules to all children of a node at once. The children
+// differ from 'parent' only in the candidate prepended to its sequence, so
+// the counts each rule needs are gathered for every child in one pass.
+// Scores are the same as those given by ApplyScoringRules for each child.
+//
+// INPUT
+// ballots:  Original ballot signatures in election
+// cand:     Set of candidates in election (Candidate data structures)
+// config:   Basic parameters
+// parent:   Node that has been expanded
+// children: Children of 'parent' (as produced by GetChildren)
+//
+// OUTPUT:
+// children[i].dist will be set to the score calculated (if higher than its
+// current evaluation)
+void ApplyScoringRules(const Ballots &ballots, const Candidates &cand,
+	const Config &config, const Node &parent, std::vector<Node> &children);
+
 // Solve LP to get a score for a partial node (lower bound on the 
 // number of vote manipulations required to realise its elimination
 // sequence) or an exact margin for a node with a complete sequence.
@@ -49,6 +168,7 @@ void ApplyScoringRules(const Ballots &ballots, const Candidates &cand,
 // tleft:      Remaining timelimit for algorithm (-1 if no timelimit)
 // log:        Stream to print logging details to.
 // dolog:      Boolean to indicate whether to print logging information.
+// scratch:    Working storage for the LP (contents are overwritten)
 //
 // OUTPUT:
 // Minimum manipulations required to realise node elimination sequence. This
@@ -58,7 +178,8 @@ void ApplyScoringRules(const Ballots &ballots, const Candidates &cand,
 //             the value returned will not be the minimum.
 double distance(const Ballots &ballots, const Candidates &cand, 
 	const Config &config, Node &node, double upperbound,
-	double tleft,  std::ofstream &log, bool dolog, bool &timeout);
+	double tleft,  std::ofstream &log, bool dolog, bool &timeout,
+	DistanceScratch &scratch);
 
 
 #endif
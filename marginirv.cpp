@@ -26,12 +26,16 @@
 #include "sim_irv.h"
 #include "math.h"
 #include "tree_irv.h"
+#include "subset_tally.h"
+#include "prefix_mask.h"
 #include "nonmono_irv_distance.h"
 
 using namespace std;
 
 // USAGE: marginstv -ballots [ballot file] [-score] [-tight] [-simlog] [-optlog]
 //            [-tlimit value] [-logfile logfilename] [-electonly N parties]
+//            [-threads N] [-cache DIR] [-checkpoint FILE]
+//            [-checkpointevery N] [-resume FILE] [-tallymem MB] [-sparse]
 //
 // -score:     Apply basic scoring rules to prune search
 // -tight:     Apply tighter scoring rules to prune search (supercedes score)
@@ -44,6 +48,21 @@ using namespace std;
 //              Party1 Party2 ... PartyN
 //
 //              Example: -electonly 2 LIB LAB
+// -threads:   Number of threads used to evaluate nodes in branch and bound
+//             (default 1). With more than one thread, -optlog is ignored.
+// -cache:     Directory in which LP results are stored. Results recorded
+//             by earlier runs on the same ballot profile are reused rather
+//             than solved again.
+// -checkpoint: File to which the state of branch and bound is saved when
+//             it terminates (in particular, on reaching the time limit).
+// -checkpointevery: Also save the state every N seconds.
+// -resume:    Continue the search saved in a checkpoint file. The ballots
+//             and -score/-tight/-electonly settings must be the same as
+//             in the run that saved it.
+// -tallymem:  Memory (in MB, default 256) available for caching the
+//             tallies used by the scoring rules.
+// -sparse:    Only create LP variables for ballot equivalence classes that
+//             occur in the profile (for elections with many candidates).
 //
 // NOTE: This code implements Blom et. al.'s modification of Magrino et. al.'s 
 // margin computation algorithm (by adding lower bounding rules to prune
@@ -67,6 +86,11 @@ int main(int argc, const char * argv[])
 		Config config;
 
 		const char *logf = NULL;
+		const char *cachedir = NULL;
+		const char *checkpointf = NULL;
+		const char *resumef = NULL;
+		double checkpointint = -1;
+		double tallymem = 256;
 		bool simlog = false;
 		double timelimit = -1;
         bool debugjiri = false;
@@ -96,10 +120,37 @@ int main(int argc, const char * argv[])
 				timelimit = atoi(argv[i+1]);
 				++i;
 			}
+			else if(strcmp(argv[i], "-threads")== 0 && i < argc-1){
+				config.nthreads = max(1, atoi(argv[i+1]));
+				++i;
+			}
 			else if(strcmp(argv[i], "-logfile")== 0 && i < argc-1){
 				logf = argv[i+1];
 				++i;
 			}
+			else if(strcmp(argv[i], "-cache")== 0 && i < argc-1){
+				cachedir = argv[i+1];
+				++i;
+			}
+			else if(strcmp(argv[i], "-checkpoint")== 0 && i < argc-1){
+				checkpointf = argv[i+1];
+				++i;
+			}
+			else if(strcmp(argv[i], "-checkpointevery")== 0 && i < argc-1){
+				checkpointint = atoi(argv[i+1]);
+				++i;
+			}
+			else if(strcmp(argv[i], "-resume")== 0 && i < argc-1){
+				resumef = argv[i+1];
+				++i;
+			}
+			else if(strcmp(argv[i], "-tallymem")== 0 && i < argc-1){
+				tallymem = max(0.0, atof(argv[i+1]));
+				++i;
+			}
+			else if(strcmp(argv[i], "-sparse") == 0){
+				config.sparseclasses = true;
+			}
             else if(strcmp(argv[i], "-electonly") == 0){
                 int n_in_list = atoi(argv[i+1]);
                 for(int j = 0; j < n_in_list; ++j){
@@ -170,11 +221,36 @@ int main(int argc, const char * argv[])
 			return 0;
 		}
 
+		// Tallies for the scoring rules
+		unique_ptr<SubsetTallyCache> tallies;
+		if(config.compbounds && 
+			config.ncandidates <= MAX_TREE_CANDIDATES){
+			tallies.reset(new SubsetTallyCache(config.ballotstore,
+				config.ncandidates, tallymem*1024*1024));
+			config.tallies = tallies.get();
+		}
+
+		unique_ptr<PrefixMaskSet> masks;
+		if(config.tightbounds && tallies && !tallies->Tabulated()){
+			masks.reset(new PrefixMaskSet());
+			if(masks->Build(config.ballotstore, config.ncandidates)){
+				config.masks = masks.get();
+			}
+		}
+
 		// Run branch and bound
 		bool timeout = false;
 		int dtcntr = 0;
+		double buildtime = 0;
+		double solvetime = 0;
+		DistanceCache cache;
+		if(cachedir != NULL){
+			cache.Open(cachedir, ballots, config);
+		}
+
 		double r = RunTreeIRV(ballots, candidates, config, altwinners,
-			upperbound, timelimit, logf, timeout, dtcntr);
+			upperbound, timelimit, logf, checkpointf, checkpointint,
+			resumef, timeout, dtcntr, buildtime, solvetime, cache);
 
 		if(r == -1){
 			// Exception was raised.
@@ -195,6 +271,14 @@ int main(int argc, const char * argv[])
 			cout << "Margin:     " << r << endl;
 		}
 		cout << "LPs solved: " << dtcntr << endl;
+		cout << "LP cache:   " << cache.Hits() << " hits, " << 
+			cache.Misses() << " misses";
+		if(cachedir != NULL){
+			cout << " (" << cache.Loaded() << " results loaded)";
+		}
+		cout << endl;
+		cout << "LP time:    " << buildtime << " s building, " << 
+			solvetime << " s solving" << endl;
 		cout << "Total time: " << tend.seconds - start.seconds << endl;
 	}
 	catch(exception &e)
@@ -20,7 +20,18 @@
 #include<algorithm>
 #include<iostream>
 #include<sstream>
+#include<unordered_map>
+#include<cstring>
+#include<cstdlib>
+#include<cctype>
+#include<climits>
 #include<time.h>
+#ifndef _WIN32
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<unistd.h>
+#endif
 #include "model.h"
 
 using namespace std;
@@ -79,27 +90,396 @@ void Split(const string &line, const boostcharsep &sep, vector<string> &r)
 }
 
 
+void BallotStore::Build(const Ballots &ballots){
+	prefs.clear();
+	offsets.assign(1, 0);
+	votes.clear();
+
+	for(int i = 0; i < ballots.size(); ++i){
+		const Ints &p = ballots[i].prefs;
+		for(int j = 0; j < p.size(); ++j){
+			if(p[j] < 0 || p[j] > USHRT_MAX){
+				throw STVException("Too many candidates for ballot store.");
+			}
+		}
+		prefs.insert(prefs.end(), p.begin(), p.end());
+		offsets.push_back(prefs.size());
+		votes.push_back(ballots[i].votes);
+	}
+
+	source = ballots.data();
+}
+
+bool BallotStore::Holds(const Ballots &ballots) const{
+	return source == ballots.data() && Size() == ballots.size();
+}
+
+const BallotStore& GetBallotStore(const Ballots &ballots, 
+	const Config &config){
+	const BallotStore &store = config.ballotstore;
+	if(!store.Holds(ballots)){
+		throw STVException("Ballot store does not match ballots.");
+	}
+	return store;
+}
+
+// Contents of a ballot file. The file is memory mapped where possible, so
+// that records can be tokenized in place.
+class BallotFile{
+	private:
+		const char *data;
+		size_t size;
+		bool mapped;
+		string buffer;
+
+	public:
+		BallotFile() : data(NULL), size(0), mapped(false) {}
+
+		~BallotFile(){
+			#ifndef _WIN32
+			if(mapped){
+				munmap((void*)data, size);
+			}
+			#endif
+		}
+
+		// Returns false if the file could not be opened.
+		bool Open(const char *path){
+			#ifndef _WIN32
+			int fd = open(path, O_RDONLY);
+			if(fd < 0){
+				return false;
+			}
+
+			struct stat st;
+			if(fstat(fd, &st) == 0 && st.st_size > 0){
+				void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 
+					fd, 0);
+				if(p != MAP_FAILED){
+					madvise(p, st.st_size, MADV_SEQUENTIAL);
+					data = (const char*)p;
+					size = st.st_size;
+					mapped = true;
+					close(fd);
+					return true;
+				}
+			}
+			close(fd);
+			#endif
+
+			// Fall back to reading the whole file into memory
+			ifstream infile(path, ios::binary);
+			if(infile.fail()){
+				return false;
+			}
+			stringstream ss;
+			ss << infile.rdbuf();
+			buffer = ss.str();
+			data = buffer.data();
+			size = buffer.size();
+			return true;
+		}
+
+		const char* begin() const { return data; }
+		const char* end() const { return data + size; }
+};
+
+// Set 'line' to the line starting at 'pos' (without its newline), and
+// returns the start of the next line. Returns NULL if 'pos' is at the
+// end of the file.
+static const char* NextLine(const char *pos, const char *end, 
+	const char *&lend){
+	if(pos >= end){
+		return NULL;
+	}
+	lend = (const char*)memchr(pos, '\n', end - pos);
+	if(lend == NULL){
+		lend = end;
+		return end;
+	}
+	return lend + 1;
+}
+
+static bool IsSpace(char ch){
+	return isspace((unsigned char)ch) != 0;
+}
+
+static bool IsBallotSeparator(char ch){
+	return ch == ',' || ch == '(' || ch == ')' || ch == ':';
+}
+
+// Binary ballot profile (see WriteBinaryBallots). All values are stored
+// in the byte order of the machine that wrote the file. The header is
+// followed by:
+//   - the candidate names and party affiliations, as 'strbytes' bytes
+//     of NUL terminated strings (name, then party, for each candidate),
+//     padded with zeros to a multiple of 8 bytes;
+//   - double votes[nballots]: number of votes for each signature;
+//   - long long offsets[nballots+1]: signature i's preferences are
+//     prefs[offsets[i]] to prefs[offsets[i+1]-1];
+//   - prefs[nprefs]: candidate indices, of 'prefwidth' bytes each.
+// Signatures are distinct, and stored in the order ReadBallots would
+// create them from the text profile.
+static const char BINARY_MAGIC[8] = {'I','R','V','B','A','L','L','T'};
+static const int BINARY_VERSION = 1;
+
+struct BinaryProfileHeader{
+	char magic[8];
+	int version;
+	int ncandidates;
+	int nballots;
+	int prefwidth;
+	long long nprefs;
+	long long strbytes;
+	double totalvotes;
+};
+
+static size_t PaddedSize(size_t n){
+	return (n + 7) & ~size_t(7);
+}
+
+// Number of bytes used to store each preference in a binary profile with
+// 'ncand' candidates.
+static int PrefWidth(int ncand){
+	if(ncand <= 256) return 1;
+	if(ncand <= 65536) return 2;
+	return 4;
+}
+
+bool WriteBinaryBallots(const char *path, const Ballots &ballots,
+	const Candidates &candidates, const Config &config)
+{
+	string strings;
+	for(int i = 0; i < candidates.size(); ++i){
+		strings += candidates[i].name;
+		strings += '\0';
+		strings += candidates[i].party;
+		strings += '\0';
+	}
+
+	BinaryProfileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BINARY_MAGIC, 8);
+	header.version = BINARY_VERSION;
+	header.ncandidates = config.ncandidates;
+	header.nballots = ballots.size();
+	header.prefwidth = PrefWidth(config.ncandidates);
+	header.strbytes = strings.size();
+	header.totalvotes = config.totalvotes;
+
+	Doubles votes(ballots.size());
+	vector<long long> offsets(ballots.size()+1, 0);
+	for(int i = 0; i < ballots.size(); ++i){
+		votes[i] = ballots[i].votes;
+		offsets[i+1] = offsets[i] + ballots[i].prefs.size();
+	}
+	header.nprefs = offsets.back();
+
+	vector<unsigned char> prefs(header.nprefs * header.prefwidth);
+	long long k = 0;
+	for(int i = 0; i < ballots.size(); ++i){
+		for(int j = 0; j < ballots[i].prefs.size(); ++j, ++k){
+			const unsigned int c = ballots[i].prefs[j];
+			if(header.prefwidth == 1){
+				prefs[k] = c;
+			}
+			else if(header.prefwidth == 2){
+				((unsigned short*)&prefs[0])[k] = c;
+			}
+			else{
+				((unsigned int*)&prefs[0])[k] = c;
+			}
+		}
+	}
+
+	strings.resize(PaddedSize(strings.size()), '\0');
+
+	ofstream out(path, ios::binary);
+	out.write((const char*)&header, sizeof(header));
+	out.write(strings.data(), strings.size());
+	if(!votes.empty()){
+		out.write((const char*)&votes[0], votes.size()*sizeof(double));
+	}
+	out.write((const char*)&offsets[0], offsets.size()*sizeof(long long));
+	if(!prefs.empty()){
+		out.write((const char*)&prefs[0], prefs.size());
+	}
+	out.close();
+
+	if(!out){
+		cerr << "ERROR: Could not write binary ballot file " << path 
+			<< "." << endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Read a binary profile from 'infile' (see WriteBinaryBallots). The
+// signature arrays are read directly from the file's memory mapping.
+static bool ReadBinaryBallots(const BallotFile &infile, const char *path,
+	Ballots &ballots, Candidates &candidates, Config &config)
+{
+	const char *data = infile.begin();
+	const size_t size = infile.end() - infile.begin();
+
+	stringstream err;
+	err << "ERROR: Reading ballot file: corrupt binary profile " << path;
+
+	BinaryProfileHeader header;
+	if(size < sizeof(header)){
+		throw STVException(err.str() + ".");
+	}
+	memcpy(&header, data, sizeof(header));
+
+	if(header.version != BINARY_VERSION){
+		stringstream ss;
+		ss << "ERROR: Reading ballot file: " << path << " is a binary"
+			<< " profile of unsupported version " << header.version << ".";
+		throw STVException(ss.str());
+	}
+
+	if(header.ncandidates < 0 || header.nballots < 0 || 
+		header.nprefs < 0 || header.strbytes < 0 ||
+		header.nballots > size || header.nprefs > size || 
+		header.strbytes > size ||
+		header.prefwidth != PrefWidth(header.ncandidates)){
+		throw STVException(err.str() + ".");
+	}
+
+	const size_t strstart = sizeof(header);
+	const size_t votestart = strstart + PaddedSize(header.strbytes);
+	const size_t offstart = votestart + header.nballots*sizeof(double);
+	const size_t prefstart = offstart + 
+		(header.nballots+1)*sizeof(long long);
+	const size_t total = prefstart + header.nprefs*header.prefwidth;
+
+	if(size != total){
+		throw STVException(err.str() + ": unexpected file size.");
+	}
+
+	// Candidate names and party affiliations
+	const char *str = data + strstart;
+	const char *strend = str + header.strbytes;
+	for(int i = 0; i < header.ncandidates; ++i){
+		const char *name = str;
+		str = (const char*)memchr(str, '\0', strend - str);
+		if(str == NULL){
+			throw STVException(err.str() + ".");
+		}
+		const char *party = ++str;
+		str = (const char*)memchr(str, '\0', strend - str);
+		if(str == NULL){
+			throw STVException(err.str() + ".");
+		}
+		++str;
+
+		Candidate c;
+		c.index = candidates.size();
+		c.name = name;
+		c.party = party;
+		candidates.push_back(c);
+
+        config.name2index.insert(pair<string, int>(c.name, c.index));
+        config.index2name.insert(pair<int, string>(c.index, c.name));
+	}
+	config.ncandidates = candidates.size();
+
+	// Signatures
+	const double *votes = (const double*)(data + votestart);
+	const long long *offsets = (const long long*)(data + offstart);
+	const unsigned char *prefs = (const unsigned char*)(data + prefstart);
+
+	int cntr = ballots.size();
+	ballots.reserve(ballots.size() + header.nballots);
+	for(int i = 0; i < header.nballots; ++i){
+		if(offsets[i] < 0 || offsets[i+1] <= offsets[i] || 
+			offsets[i+1] > header.nprefs){
+			throw STVException(err.str() + ".");
+		}
+
+		Ballot b;
+		b.tag = cntr;
+		b.votes = votes[i];
+		b.prefs.resize(offsets[i+1] - offsets[i]);
+
+		for(long long j = offsets[i]; j < offsets[i+1]; ++j){
+			unsigned int c = 0;
+			if(header.prefwidth == 1){
+				c = prefs[j];
+			}
+			else if(header.prefwidth == 2){
+				c = ((const unsigned short*)prefs)[j];
+			}
+			else{
+				c = ((const unsigned int*)prefs)[j];
+			}
+
+			if(c >= header.ncandidates){
+				throw STVException(err.str() + ".");
+			}
+			b.prefs[j - offsets[i]] = c;
+		}
+
+		Candidate &cand = candidates[b.prefs.front()];
+		cand.sum_votes += b.votes;
+		cand.ballots.push_back(b.tag);
+		config.totalvotes += b.votes;
+
+		ballots.push_back(b);
+		++cntr;
+	}
+
+	config.ballotstore.Build(ballots);
+	return true;
+}
+
 // Assumed input format:
 // (first_id, second_id, third_id, ...) : #appears
+// or a binary profile written by WriteBinaryBallots.
+//
+// The first three lines hold the candidate names, their party affiliations,
+// and a separator. Each remaining line is split at ',', '(', ')' and ':'
+// in place: every token but the last is a candidate name, and the last is
+// the number of votes. Rankings are accumulated in a buffer, and copied to
+// a new Ballot only the first time they are seen.
 bool ReadBallots(const char *path, Ballots &ballots, Candidates &candidates,
 	Config &config)
 {
 	try
 	{
-		ifstream infile(path);
-        if (infile.fail()) {
+		BallotFile infile;
+        if (!infile.Open(path)) {
             cerr << "ERROR: Could not open the ballot file." << endl;
             return false;
         }
 
+		if(infile.end() - infile.begin() >= 8 && 
+			memcmp(infile.begin(), BINARY_MAGIC, 8) == 0){
+			return ReadBinaryBallots(infile, path, ballots, candidates, 
+				config);
+		}
+
+		const char *pos = infile.begin();
+		const char *end = infile.end();
+		const char *lend = end;
+
 		// First line is list of candidates.
 		boostcharsep spcom(",");
 		string line;
-		getline(infile, line);
+		const char *next = NextLine(pos, end, lend);
+		if(next != NULL){
+			line.assign(pos, lend);
+			pos = next;
+		}
 
 		vector<string> columns;
 		Split(line, spcom, columns);
 
+		// Candidate names are interned once; name lookups while reading
+		// ballots reuse a single key buffer.
+		unordered_map<string,int> names;
+
 		config.ncandidates = columns.size();
 		for(int i = 0; i < columns.size(); ++i)
 		{
@@ -113,10 +493,16 @@ bool ReadBallots(const char *path, Ballots &ballots, Candidates &candidates,
 
             config.name2index.insert(pair<string, int>(name, i));
             config.index2name.insert(pair<int, string>(i, name));
+			names.insert(make_pair(name, i));
 		}
 
 		// Read party affiliations
-		getline(infile, line);
+		line.clear();
+		next = NextLine(pos, end, lend);
+		if(next != NULL){
+			line.assign(pos, lend);
+			pos = next;
+		}
 		columns.clear();
 		Split(line, spcom, columns);
         if (columns.size() != candidates.size()) {
@@ -128,64 +514,113 @@ bool ReadBallots(const char *path, Ballots &ballots, Candidates &candidates,
 		}
 
 		// Skip next line (separator)
-		getline(infile, line);
+		next = NextLine(pos, end, lend);
+		if(next != NULL){
+			pos = next;
+		}
+
+		// Index (tag) of the ballot with each distinct ranking read so far.
+		unordered_map<string,int> signatures;
+		for(int i = 0; i < ballots.size(); ++i){
+			if(!ballots[i].prefs.empty()){
+				const Ints &p = ballots[i].prefs;
+				signatures.insert(make_pair(string((const char*)&p[0],
+					p.size()*sizeof(int)), ballots[i].tag));
+			}
+		}
+
+		// Line on which each candidate last appeared, used to ignore
+		// repeated preferences.
+		Ints seen(config.ncandidates, 0);
 
-		boostcharsep sp(",():");
+		vector<pair<const char*,const char*> > tokens;
+		Ints prefs;
+		string key;
+		string votestr;
 		
 		int cntr = ballots.size();
         int linec = 3;
-		while(getline(infile, line))
+		while((next = NextLine(pos, end, lend)) != NULL)
 		{
             linec ++;
-			vector<string> columns;
-			Split(line, sp, columns);
+			const char *lstart = pos;
+			pos = next;
 
-			Ballot b;
-			b.tag = cntr;
-			b.votes = ToType<double>(columns.back());
+			// Split the line into tokens, trimmed of white space. Tokens
+			// that are empty once trimmed are kept, as the last token is
+			// the number of votes whatever its content.
+			tokens.clear();
+			const char *t = lstart;
+			while(t < lend){
+				while(t < lend && IsBallotSeparator(*t)) ++t;
+				if(t == lend) break;
 
-			for(int i = 0; i < columns.size()-1; ++i)
+				const char *tend = t;
+				while(tend < lend && !IsBallotSeparator(*tend)) ++tend;
+
+				const char *ts = t;
+				const char *te = tend;
+				while(ts < te && IsSpace(*ts)) ++ts;
+				while(te > ts && IsSpace(*(te-1))) --te;
+				tokens.push_back(make_pair(ts, te));
+
+				t = tend;
+			}
+
+			// Blank lines hold no ballot
+			if(tokens.empty()) continue;
+
+			votestr.assign(tokens.back().first, tokens.back().second);
+			char *vend = NULL;
+			const double votes = strtod(votestr.c_str(), &vend);
+			if(votestr.empty() || *vend != '\0'){
+				stringstream ss;
+				ss << "ERROR: Reading ballot file: invalid number of votes \""
+					<< votestr << "\" (line " << linec << " of " << path 
+					<< ").";
+				throw STVException(ss.str());
+			}
+
+			prefs.clear();
+			for(int i = 0; i < tokens.size()-1; ++i)
 			{
-				if(columns[i].empty()) continue;
-//				int ccode = ToType<int>(columns[i]);
-                string name = columns[i];
-                if (config.name2index.find(name) == config.name2index.end()) {
+				if(tokens[i].first == tokens[i].second) continue;
+
+				key.assign(tokens[i].first, tokens[i].second);
+				unordered_map<string,int>::const_iterator it = names.find(key);
+                if (it == names.end()) {
                     cerr << "ERROR: Reading ballot file: unknown candidate name \"" <<
-                    name << "\" (line " << linec << " of " << path << ")." << endl;
+                    key << "\" (line " << linec << " of " << path << ")." << endl;
                     return false;
                 }
 
-				int index = config.name2index.find(name)->second;
-					
-				if(find(b.prefs.begin(),
-					b.prefs.end(), index) != b.prefs.end())
-				{
-					continue;
+				const int index = it->second;
+				if(seen[index] != linec){
+					seen[index] = linec;
+					prefs.push_back(index);
 				}
-
-				b.prefs.push_back(index);
 			}
 
-			if(b.prefs.empty()) continue;
+			if(prefs.empty()) continue;
 
-			Candidate &cand = candidates[b.prefs.front()];
-			bool found_ballot = false;
-			int bid = -1;
-			for(int j = 0; j < cand.ballots.size(); ++j){
-				const Ballot &bf = ballots[cand.ballots[j]];
-				if(bf.prefs == b.prefs){
-					bid = bf.tag;
-					found_ballot = true;
-					break;
-				}
-			}
-			if(found_ballot){
-				ballots[bid].votes += b.votes;
-				cand.sum_votes += b.votes;
-				config.totalvotes += b.votes;
+			Candidate &cand = candidates[prefs.front()];
+			key.assign((const char*)&prefs[0], prefs.size()*sizeof(int));
+			pair<unordered_map<string,int>::iterator,bool> sig = 
+				signatures.insert(make_pair(key, cntr));
+
+			if(!sig.second){
+				const int bid = sig.first->second;
+				ballots[bid].votes += votes;
+				cand.sum_votes += votes;
+				config.totalvotes += votes;
 				continue;
 			}
 			else{
+				Ballot b;
+				b.tag = cntr;
+				b.votes = votes;
+				b.prefs = prefs;
+
 				cand.sum_votes += b.votes;
 				cand.ballots.push_back(b.tag);
 
@@ -196,7 +631,7 @@ bool ReadBallots(const char *path, Ballots &ballots, Candidates &candidates,
 			}
 		}
 
-		infile.close();
+		config.ballotstore.Build(ballots);
 	}
 	catch(exception &e)
 	{
@@ -47,6 +47,42 @@ struct mytimespec
 
 void GetTime(struct mytimespec* t);
 
+struct Ballot;
+class SubsetTallyCache;
+class PrefixMaskSet;
+
+// Candidate index as stored in a BallotStore
+typedef unsigned short Pref;
+
+// Ballot signatures stored contiguously in compressed row form: the
+// preferences of signature 'b' are prefs[offsets[b]] to 
+// prefs[offsets[b+1]-1], and votes[b] is the number of votes for it.
+// Signature 'b' is the Ballot with tag 'b'. Loops over all ballots read
+// the store rather than chasing one vector per Ballot.
+struct BallotStore
+{
+	std::vector<Pref> prefs;
+	std::vector<int> offsets;
+	std::vector<double> votes;
+
+	// The ballots the store was built from (their first element), so that
+	// it is not read in place of a different profile of the same size
+	const Ballot *source;
+
+	BallotStore() : offsets(1, 0), source(NULL) {}
+
+	int Size() const { return votes.size(); }
+
+	const Pref* Begin(int b) const { return prefs.data() + offsets[b]; }
+	const Pref* End(int b) const { return prefs.data() + offsets[b+1]; }
+
+	// Replace the contents of the store with 'ballots'
+	void Build(const std::vector<Ballot> &ballots);
+
+	// True if the store was built from 'ballots' (and they have not
+	// been added to or reallocated since)
+	bool Holds(const std::vector<Ballot> &ballots) const;
+};
 
 struct Config
 {
@@ -60,12 +96,33 @@ struct Config
     bool allowties;
     bool test_all_losers;
 
+	// Number of threads used to evaluate nodes in branch and bound
+	int nthreads;
+
+	// If true, the LP for a node has variables only for the equivalence 
+	// classes of ballots that occur in the profile, with new ballots 
+	// modelled as flows between candidates (see distance()).
+	bool sparseclasses;
+
     std::map<std::string,int> name2index;
     std::map<int, std::string> index2name;
 	Strings elect_only;
 
+	// Ballots read by ReadBallots, in compressed form
+	BallotStore ballotstore;
+
+	// Tallies for sets of continuing candidates, used by the scoring
+	// rules if not NULL (built from 'ballotstore' by the caller).
+	const SubsetTallyCache *tallies;
+
+	// Prefix masks used by the tight scoring rule in place of a traversal 
+	// of the tallies' trie when their table does not fit in memory, if 
+	// not NULL (built from 'ballotstore' by the caller).
+	const PrefixMaskSet *masks;
+
 	Config() : ncandidates(0), totalvotes(0), tightbounds(false),
-               compbounds(false), optlog(false), debug(false), allowties(false), test_all_losers(false) {}
+               compbounds(false), optlog(false), debug(false), allowties(false), test_all_losers(false),
+               nthreads(1), sparseclasses(false), tallies(NULL), masks(NULL) {}
 };
 
 class STVException
@@ -121,44 +178,47 @@ typedef std::vector<Ballot> Ballots;
 template <typename T>
 T ToType(const std::string &s);
 
-typedef std::map<std::vector<int>,int> I2Map;
+// Largest number of candidates supported by branch and bound (Node stores
+// the set of remaining candidates as a bitmask).
+#define MAX_TREE_CANDIDATES 64
+
+typedef unsigned long long CandMask;
 
 struct Node{
 	// Score (or LP evaluation)
 	double dist;
 
-	// Elimination sequence (partial or total)
-	Ints order_c;
+	// Elimination sequence (partial or total), one byte per candidate.
+	// The sequence is stored back to front, so that elim[len-1] is the
+	// first candidate in the sequence and new candidates can be added to
+	// the front without moving the others.
+	unsigned char elim[MAX_TREE_CANDIDATES];
+	int len;
 
 	// Set of candidates *not* in elimination sequence
-	SInts remcand;
+	CandMask remcand;
 
-	// The following three attributes used when solving LP
-	// for this node.
-	Ballots rev_ballots;
-	I2Map ballotmap;
-	Ints bid2newid;
+	Node() : dist(-1), len(0), remcand(0) {}
 
-	Node(int ncand, int nballots) {
-		bid2newid.resize(nballots, -1);
-		dist = -1;
-	}
+	// Length of the elimination sequence
+	int Size() const { return len; }
 
-	void Reset(){
-		dist = -1;
+	// Candidate in position 'i' of the elimination sequence
+	int At(int i) const { return elim[len-1-i]; }
 
-		rev_ballots.clear();
-		ballotmap.clear();
-		remcand.clear();
+	bool Remaining(int c) const { return (remcand >> c) & 1; }
 
-		for(int i = 0; i < bid2newid.size(); ++i){
-			bid2newid[i] = -1;
-		}
+	// Add candidate 'c' to the front of the elimination sequence
+	void Prepend(int c){
+		elim[len++] = c;
+		remcand &= ~(CandMask(1) << c);
 	}
 
-	void ClearEqClassData(){
-		rev_ballots.clear();
-		ballotmap.clear();
+	void GetOrder(Ints &order_c) const{
+		order_c.resize(len);
+		for(int i = 0; i < len; ++i){
+			order_c[i] = At(i);
+		}
 	}
 };
 
@@ -191,7 +251,23 @@ struct NMNode{  // NM abbreviates NonMono
 
 
 
+// Read a ballot profile, in text or binary format, from 'path'. The
+// ballots are also stored in config.ballotstore. Returns false (after 
+// printing a message) if the file cannot be read.
 bool ReadBallots(const char *path, Ballots &ballots,
 	Candidates &candidates, Config &config);
 
+// Returns config.ballotstore, checking that it was built from 'ballots'
+// (the same object, not merely one of the same size). Throws an 
+// STVException if it was not (if 'ballots' were not read by ReadBallots).
+const BallotStore& GetBallotStore(const Ballots &ballots, 
+	const Config &config);
+
+// Write a profile read by ReadBallots to 'path' in binary format. The
+// file can be given to ReadBallots in place of the text profile, and is
+// loaded without parsing or aggregating signatures. Returns false (after
+// printing a message) if the file cannot be written.
+bool WriteBinaryBallots(const char *path, const Ballots &ballots,
+	const Candidates &candidates, const Config &config);
+
 #endif
@@ -9,6 +9,7 @@ jn/04/2022
 #include<list>
 #include<iostream>
 #include<cmath>
+#include<algorithm>
 #include "cplex_utils.h"
 #include "ilcplex/cpxconst.h"  // error codes
 #include "nonmono_irv_distance.h"
@@ -145,14 +146,90 @@ std::string join(InputIt first,
 //}
 
 
-void get_promotion_set(const Candidate &winner, const Ballots &ballots, Sig2Sig &B) {
+SigTable::SigTable(int ncandidates) : slots(16, -1) {
+    width = ncandidates <= 16 ? 4 : (ncandidates <= 256 ? 8 : 16);
+    perword = 64 / width;
+    maxlen = max(ncandidates, 1);
+    stride = 1 + (maxlen + perword - 1) / perword;
+    buffer.resize(stride);
+}
+
+template<typename InputIt>
+void SigTable::Pack(InputIt first, InputIt last, unsigned long long *key) const {
+    fill(key, key + stride, 0ULL);
+    int len = 0;
+    for (; first != last; ++first, ++len) {
+        if (len == maxlen)
+            throw STVException("Signature longer than the number of candidates.");
+        key[1 + len / perword] |= (unsigned long long) *first << (width * (len % perword));
+    }
+    key[0] = len;
+}
+
+size_t SigTable::Hash(const unsigned long long *key) const {
+    unsigned long long h = 0;
+    for (int w = 0; w < stride; ++w) {
+        h = (h ^ key[w]) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+int SigTable::Insert(const unsigned long long *key) {
+    if (2 * (Size() + 1) > slots.size())
+        Grow();
+
+    const size_t mask = slots.size() - 1;
+    for (size_t i = Hash(key) & mask; ; i = (i + 1) & mask) {
+        if (slots[i] < 0) {
+            slots[i] = Size();
+            keys.insert(keys.end(), key, key + stride);
+            return slots[i];
+        }
+        if (equal(key, key + stride, keys.begin() + (size_t) slots[i] * stride))
+            return slots[i];
+    }
+}
+
+void SigTable::Grow() {
+    slots.assign(2 * slots.size(), -1);
+    const size_t mask = slots.size() - 1;
+    for (int id = 0; id < Size(); ++id) {
+        size_t i = Hash(&keys[(size_t) id * stride]) & mask;
+        while (slots[i] >= 0)
+            i = (i + 1) & mask;
+        slots[i] = id;
+    }
+}
+
+int SigTable::Intern(const Ints &sig) {
+    Pack(sig.begin(), sig.end(), buffer.data());
+    return Insert(buffer.data());
+}
+
+int SigTable::Intern(const Pref *first, const Pref *last) {
+    Pack(first, last, buffer.data());
+    return Insert(buffer.data());
+}
+
+void SigTable::Get(int id, Ints &sig) const {
+    const unsigned long long *key = &keys[(size_t) id * stride];
+    const unsigned long long m = (1ULL << width) - 1;
+    sig.resize(key[0]);
+    for (int k = 0; k < sig.size(); ++k)
+        sig[k] = (key[1 + k / perword] >> (width * (k % perword))) & m;
+}
+
+
+void get_promotion_set(const Candidate &winner, const Ballots &ballots, SigTable &sigs, SigEdges &B) {
     /*
       For each signature (key) will determine all other possible signatures (existing or non-existing)
       in which winner is promoted (moved up by 1, ... positions, all other order remaining identical)
-      OUTPUT: B
+      OUTPUT: B (transitions between ids of sigs; may contain repeats)
     */
     B.clear();
     for (int bi = 0; bi < ballots.size(); ++bi) {
+        const int source = sigs.Intern(ballots[bi].prefs);
         Ints prefs = ballots[bi].prefs;
         // look for winner position in this signature
         Ints::iterator pi;
@@ -162,27 +239,27 @@ void get_promotion_set(const Candidate &winner, const Ballots &ballots, Sig2Sig
         if (winner_pos < prefs.size()) prefs.erase(pi);
         // move up winner from his orig position, or insert winner before pos 1, and up, if he was absent
         // all insertions are before position winner_pos
-        set<Ints> prefs_set;  // holds unq promoting signatures
         int insert_pos;
         for(insert_pos = winner_pos - 1; insert_pos >= 0; --insert_pos) {
             Ints auxprefs = prefs;
             auxprefs.insert(auxprefs.begin() + insert_pos, winner.index);
-            prefs_set.insert(auxprefs);
+            B.push_back(make_pair(source, sigs.Intern(auxprefs)));
         }
-        B.insert(pair<Ints, set<Ints> >(ballots[bi].prefs, prefs_set));
     }
 }
 
 
-void get_demotion_set(const Candidate &target_candidate, const Ballots &ballots, const Candidates &candidates, Sig2Sig &D) {
+void get_demotion_set(const Candidate &target_candidate, const Ballots &ballots, const Candidates &candidates,
+                      SigTable &sigs, SigEdges &D) {
     /*
       For each signature (key) will determine all other possible signatures (existing or non-existing)
       in which target candidates is demoted (moved down by 1, ... positions, all other slots remaining identical
       ...with a few caveats, see code)
-      OUTPUT: D (demotion set)
+      OUTPUT: D (demotion set, as transitions between ids of sigs; may contain repeats)
     */
     D.clear();
     for (int di = 0; di < ballots.size(); ++di) {
+        const int source = sigs.Intern(ballots[di].prefs);
         Ints prefs = ballots[di].prefs;
         // look for target cand position in this signature
         Ints::iterator pi;
@@ -191,18 +268,16 @@ void get_demotion_set(const Candidate &target_candidate, const Ballots &ballots,
         // shrink the array by removing the target
         if (target_pos < prefs.size()) prefs.erase(pi);
         // move down the target from his orig position
-        set<Ints> prefs_set;
         int insert_pos;
         for(insert_pos = target_pos + 1; insert_pos <= prefs.size(); ++insert_pos) {
             Ints auxprefs = prefs;
             auxprefs.insert(auxprefs.begin() + insert_pos, target_candidate.index);
-            prefs_set.insert(auxprefs);
+            D.push_back(make_pair(source, sigs.Intern(auxprefs)));
         }
         // also remove the target from the signature completely, if signature has 2+ elements
         // this part could be questionable
         if (prefs.size() > 0) {
-            Ints auxprefs = prefs;
-            prefs_set.insert(auxprefs);
+            D.push_back(make_pair(source, sigs.Intern(prefs)));
         } else {  // if signature only contains target_cand then replace it with all other candidates one by one
             Candidates::const_iterator ci;
             for (ci=candidates.begin(); ci!=candidates.end(); ++ci) {
@@ -210,10 +285,9 @@ void get_demotion_set(const Candidate &target_candidate, const Ballots &ballots,
                     continue;
                 Ints auxprefs;
                 auxprefs.push_back(ci->index);
-                prefs_set.insert(auxprefs);
+                D.push_back(make_pair(source, sigs.Intern(auxprefs)));
             }
         }
-        D.insert(pair<Ints, set<Ints> >(ballots[di].prefs, prefs_set));
     }
 }
 
@@ -221,11 +295,11 @@ bool cmp_ints(const int &a, const int &b) {
     return a<=b;
 }
 
-void get_bottom_set(const Candidate &target_cand, const Candidates &candidates, set<Ints> &S) {
+void get_bottom_set(const Candidate &target_cand, const Candidates &candidates, SigTable &sigs, Ints &S) {
     /*
       Generate a full set of signatures s.t. target_candidate appears bottom in the ballot
       The target_candidate can refer to winner or a loser (depending on use case).
-      Returns: std::set
+      Returns: sorted ids (in sigs) of the signatures
     */
     S.clear();
     Ints CmL; // permutations of all cands excluding the target (loser)
@@ -233,34 +307,171 @@ void get_bottom_set(const Candidate &target_cand, const Candidates &candidates,
         if (i != target_cand.index)
             CmL.push_back(i);
     // generate permutations of everyone but target
-    set<Ints> perms;
+    Ints aux;
     do {
-        if (perms.find(CmL) == perms.end())
-            perms.insert(CmL);
+        aux = CmL;
+        aux.push_back(target_cand.index);
+        S.push_back(sigs.Intern(aux));
     } while(next_permutation(CmL.begin(), CmL.end(), cmp_ints));
 
-    set<Ints>::iterator i;
-    for (i = perms.begin(); i != perms.end(); ++i) {
-        Ints aux;
-        aux = *i;
-        aux.push_back(target_cand.index);
-        S.insert(aux);
+    sort(S.begin(), S.end());
+    S.erase(unique(S.begin(), S.end()), S.end());
+}
+
+
+void ballots_to_sigcounts(const BallotStore &store, SigTable &sigs, Doubles &counts) {
+    for (int b = 0; b < store.Size(); ++b) {
+        const int id = sigs.Intern(store.Begin(b), store.End(b));
+        if (id >= counts.size())
+            counts.resize(id + 1, 0.);
+        counts[id] += store.votes[b];
+    }
+}
+
+
+
+// Group the transitions by the signature in 'keys' (compressed row form):
+// the transitions with key s are edges[start[s]] to edges[start[s+1]-1].
+void build_adjacency(const Ints &keys, int nsigs, Ints &start, Ints &edges) {
+    start.assign(nsigs + 1, 0);
+    for (int t = 0; t < keys.size(); ++t)
+        ++start[keys[t] + 1];
+    for (int s = 0; s < nsigs; ++s)
+        start[s + 1] += start[s];
+
+    edges.resize(keys.size());
+    Ints next(start.begin(), start.end() - 1);
+    for (int t = 0; t < keys.size(); ++t)
+        edges[next[keys[t]]++] = t;
+}
+
+
+// Orders signature ids by their (unpacked) signatures
+struct SigOrder {
+    const vector<Ints> &sigs;
+    SigOrder(const vector<Ints> &s) : sigs(s) {}
+    bool operator()(int a, int b) const { return sigs[a] < sigs[b]; }
+};
+
+
+// Index the signatures of 'sigs' (with the given counts) and the transitions
+// 'T' into 'ctx'. Signatures are put in lexicographic order and transitions
+// ordered by source and then target, which is the order the ILPs have always
+// been built in. rank[id] is the index in ctx.sigs of signature 'id'.
+void index_signatures(const SigTable &sigs, Doubles counts, const SigEdges &T, NMContext &ctx, Ints &rank) {
+    const int n = sigs.Size();
+    counts.resize(n, 0.);
+
+    vector<Ints> unpacked(n);
+    Ints order(n);
+    for (int id = 0; id < n; ++id) {
+        sigs.Get(id, unpacked[id]);
+        order[id] = id;
+    }
+    sort(order.begin(), order.end(), SigOrder(unpacked));
+
+    rank.resize(n);
+    ctx.sigs.resize(n);
+    ctx.counts.resize(n);
+    for (int r = 0; r < n; ++r) {
+        rank[order[r]] = r;
+        ctx.sigs[r].swap(unpacked[order[r]]);
+        ctx.counts[r] = counts[order[r]];
+    }
+
+    SigEdges edges(T.size());
+    for (int t = 0; t < T.size(); ++t)
+        edges[t] = make_pair(rank[T[t].first], rank[T[t].second]);
+    sort(edges.begin(), edges.end());
+    edges.erase(unique(edges.begin(), edges.end()), edges.end());
+
+    ctx.total_n = 0;
+    for (int t = 0; t < edges.size(); ++t) {
+        ctx.from.push_back(edges[t].first);
+        ctx.to.push_back(edges[t].second);
+        ctx.total_n += (int) ctx.counts[edges[t].first];
     }
+
+    build_adjacency(ctx.from, n, ctx.out_start, ctx.out_edges);
+    build_adjacency(ctx.to, n, ctx.in_start, ctx.in_edges);
+}
+
+
+void build_promoting_context(const Candidate &w, const Ballots &ballots, const Config &config, NMContext &ctx) {
+    ctx = NMContext();
+
+    // intern the ballots' signatures, with their counts
+    SigTable sigs(config.ncandidates);
+    Doubles counts;
+    ballots_to_sigcounts(GetBallotStore(ballots, config), sigs, counts);
+
+    SigEdges B;
+    get_promotion_set(w, ballots, sigs, B);
+    Ints rank;
+    index_signatures(sigs, counts, B, ctx, rank);
+}
+
+
+void build_demoting_context(const Candidate &target_cand, const Ballots &ballots, const Candidates &cand,
+                            const Config &config, NMContext &ctx) {
+    ctx = NMContext();
+
+    // intern the ballots' signatures, with their counts
+    SigTable sigs(config.ncandidates);
+    Doubles counts;
+    ballots_to_sigcounts(GetBallotStore(ballots, config), sigs, counts);
+
+    SigEdges D;
+    get_demotion_set(target_cand, ballots, cand, sigs, D);
+    Ints rank;
+    index_signatures(sigs, counts, D, ctx, rank);
 }
 
 
-void ballots_to_sigcounts(const Ballots &ballots, Sig2N &sig2n) {
-    Ballots::const_iterator bi;
-    for (bi = ballots.cbegin(); bi != ballots.cend(); ++bi) {
-        if (sig2n.find(bi->prefs) == sig2n.end())
-            sig2n[bi->prefs] = bi->votes;
+void build_participation_context(const Candidate &target_cand, const Ballots &ballots, const Candidates &cand,
+                                 const Config &config, NMContext &ctx) {
+    ctx = NMContext();
+
+    // intern the ballots' signatures, with their counts
+    SigTable sigs(config.ncandidates);
+    Doubles counts;
+    ballots_to_sigcounts(GetBallotStore(ballots, config), sigs, counts);
+
+    // add the bottom patterns (with a zero count if they are not cast)
+    Ints S;
+    get_bottom_set(target_cand, cand, sigs, S);
+
+    Ints rank;
+    index_signatures(sigs, counts, SigEdges(), ctx, rank);
+
+    vector<bool> bottom(ctx.sigs.size(), false);
+    for (int k = 0; k < S.size(); ++k)
+        bottom[rank[S[k]]] = true;
+
+    // ILP variables are only defined for the bottom patterns
+    ctx.nvars = 0;
+    for (int i = 0; i < ctx.sigs.size(); ++i) {
+        ctx.total_n += ctx.counts[i];
+        if (bottom[i])
+            ctx.ilpid.push_back(ctx.nvars++);
         else
-            sig2n[bi->prefs] += bi->votes;
+            ctx.ilpid.push_back(-1);
     }
 }
 
 
-double promoting_nonmono_distance(const Candidate &w, const Ballots &ballots, const Candidates &cand, const Config &config, NMNode &node,
+// ILP variable names are only used in debug logs and solution dumps, so they
+// are built on demand rather than formatted for every variable of every ILP.
+string transition_varname(const string &prefix, const Ints &s1, const Ints &s2) {
+    return prefix + join(s1.begin(), s1.end(), "") + "_" + join(s2.begin(), s2.end(), "");
+}
+
+string signature_varname(const string &prefix, const Ints &sig) {
+    return prefix + join(sig.begin(), sig.end(), "");
+}
+
+
+double promoting_nonmono_distance(const NMContext &ctx, const Candidates &cand, const Config &config, NMNode &node,
                                   double upperbound, double tleft, ofstream &log, bool dolog, bool &timeout) {
 
     double dist = -1.;
@@ -268,94 +479,74 @@ double promoting_nonmono_distance(const Candidate &w, const Ballots &ballots, co
         Ints elim_order = node.elim_seq;  // this elim order may be partial (or full)
         const int partial_ncand = elim_order.size();
 
-        // convert Ballots to a map signature->count
-        Sig2N sig2n;
-        ballots_to_sigcounts(ballots, sig2n);
-
         double lb = max(0.0, node.dist);
         double ub = max(lb, upperbound);  // ub may be revised later if upperbound < 0
 
-        IloEnv env;
+        PooledEnv pooled;
+        IloEnv env = pooled.Env();
         IloModel cmodel(env);
 
-        Sig2Sig B;
-        get_promotion_set(w, ballots, B);
-        vector<Sig2SigPair> sig2sig_pairs;
-        for(Sig2Sig::const_iterator i = B.cbegin(); i != B.cend(); ++i) {
-            for (set<Ints>::iterator auxi = i->second.begin(); auxi != i->second.end(); ++auxi) {
-                sig2sig_pairs.push_back(make_pair(i->first, *auxi));
-                // at this time, also expand signature-count map to add signatures that are new (with count=0)
-                if (sig2n.find(*auxi) == sig2n.end())
-                    sig2n[*auxi] = 0.;
-            }
-        }
-
-        IloNumVarArray b(env, sig2sig_pairs.size());
-        IloNumVarArray ys(env, sig2n.size());
+        IloNumVarArray b(env, ctx.from.size());
+        IloNumVarArray ys(env, ctx.sigs.size());
 
-        char varname[1000];
+        const bool names = dolog && config.debug;
+        string varname;
 
         IloExpr obj(env);
         IloExpr balance(env);
         int i;
 
-        // define all b_s1_s2 transitions. B variables are indexed shadowing sig2sig_pairs vector order
-        int total_n = 0;
-        for(i = 0; i < sig2sig_pairs.size(); ++i) {
+        // define all b_s1_s2 transitions. B variables are indexed shadowing ctx.from/ctx.to order
+        for(i = 0; i < ctx.from.size(); ++i) {
             // b_s1_s2 - the promoting transition between two signatures. indexed via sig2sig_it vector
-            int ns = (int) sig2n[sig2sig_pairs[i].first];
-            sprintf(varname, "vb_%s", (join(sig2sig_pairs[i].first.begin(), sig2sig_pairs[i].first.end(), "")+\
-                "_" + join(sig2sig_pairs[i].second.begin(), sig2sig_pairs[i].second.end(), "")).c_str());
-            b[i] = IloNumVar(env, 0, ns, ILOINT, varname);
+            int ns = (int) ctx.counts[ctx.from[i]];
+            if (names)
+                varname = transition_varname("vb_", ctx.sigs[ctx.from[i]], ctx.sigs[ctx.to[i]]);
+            b[i] = IloNumVar(env, 0, ns, ILOINT, names ? varname.c_str() : NULL);
             obj += b[i];
-            total_n += ns;
             if (dolog && config.debug) {
                 log << "DEBUG: (var, sig, sig): " << varname << ", (" << \
-                join(sig2sig_pairs[i].first.begin(),sig2sig_pairs[i].first.end()) << "), (" << \
-                join(sig2sig_pairs[i].second.begin(),sig2sig_pairs[i].second.end()) << "), " << endl;
+                join(ctx.sigs[ctx.from[i]].begin(),ctx.sigs[ctx.from[i]].end()) << "), (" << \
+                join(ctx.sigs[ctx.to[i]].begin(),ctx.sigs[ctx.to[i]].end()) << "), " << endl;
             }
         }
         // over all unique signatures
         // collect sums over outgoing and incoming
-        Sig2N::const_iterator it;
-        for(i = 0, it = sig2n.cbegin(); i < sig2n.size(); ++i, ++it) {
-            IloExpr sum_s1(env);
-            bool sum_s1_empty = true;
+        for(i = 0; i < ctx.sigs.size(); ++i) {
+            const Ints &sig = ctx.sigs[i];
             // outgoing
-            for (int j = 0; j < sig2sig_pairs.size(); ++j)
-                if (sig2sig_pairs[j].first == it->first) {
-                    sum_s1 += b[j];
-                    sum_s1_empty = false;
-                }
+            IloExpr sum_s1(env);
+            for (int j = ctx.out_start[i]; j < ctx.out_start[i+1]; ++j)
+                sum_s1 += b[ctx.out_edges[j]];
 
             // incoming
             IloExpr sum_s2(env);
-            for (int j = 0; j < sig2sig_pairs.size(); ++j)
-                if (sig2sig_pairs[j].second == it->first) {
-                    sum_s2 += b[j];
-                }
-            int ns = (int) it->second;
-//            sprintf(varname, "vys_%d", i);
-            sprintf(varname, "vys_%s", (join(it->first.begin(), it->first.end(), "").c_str()));
-            ys[i] = IloNumVar(env, 0, total_n, ILOINT, varname);
+            for (int j = ctx.in_start[i]; j < ctx.in_start[i+1]; ++j)
+                sum_s2 += b[ctx.in_edges[j]];
+            int ns = (int) ctx.counts[i];
+            if (names)
+                varname = signature_varname("vys_", sig);
+            ys[i] = IloNumVar(env, 0, ctx.total_n, ILOINT, names ? varname.c_str() : NULL);
             if (dolog && config.debug) {
                 log << "DEBUG: (var corresponds to sig, n): " << varname << ", (" << \
-                join(it->first.begin(),it->first.end()) << ") " << it->second << endl;
+                join(sig.begin(),sig.end()) << ") " << ctx.counts[i] << endl;
             }
 
             cmodel.add(ns - sum_s1 + sum_s2 == ys[i]);    // balance equation (vote preservation)
-            if (! sum_s1_empty)
+            if (ctx.out_start[i+1] > ctx.out_start[i])
                 cmodel.add(sum_s1 <= ns);
             sum_s1.end();
             sum_s2.end();
 
         }
         if (upperbound < 0)
-            ub = total_n;
+            ub = ctx.total_n;
         cmodel.add(obj >= lb);
         cmodel.add(obj <= ub);
 
         cmodel.add(IloMinimize(env, obj));
+        obj.end();
+        balance.end();
 
         set<int> defeated;
         for(int round = 0; round < elim_order.size() + (elim_order.size()==config.ncandidates ? - 1: 0); ++round) {
@@ -367,8 +558,8 @@ double promoting_nonmono_distance(const Candidate &w, const Ballots &ballots, co
                     continue;
                 IloExpr yopp(env);
                 // we have elim cand and an opponent, look for how many votes goes to each
-                for(i = 0, it = sig2n.begin(); it != sig2n.end(); ++i, ++it)
-                    for(Ints::const_iterator j = (it->first).begin(); j != (it->first).end(); ++j) {
+                for(i = 0; i < ctx.sigs.size(); ++i)
+                    for(Ints::const_iterator j = ctx.sigs[i].begin(); j != ctx.sigs[i].end(); ++j) {
                         if (defeated.find(*j)!=defeated.end())
                             continue; // ignore cands previously eliminated
                         if (*j == e) {
@@ -389,7 +580,9 @@ double promoting_nonmono_distance(const Candidate &w, const Ballots &ballots, co
                     cmodel.add(ye <= yopp);
                 else
                     cmodel.add(ye <= yopp - 0.01);
+                yopp.end();
             }
+            ye.end();
             // this cand is now eliminated
             defeated.insert(e);
         }
@@ -433,14 +626,19 @@ double promoting_nonmono_distance(const Candidate &w, const Ballots &ballots, co
             log << "SOLUTION (non-zero only) = " << endl;
             for(i=0; i<b.getSize(); ++i) {
                 if (soln[i] > 0)
-                    log << b[i].getName() << " = " << soln[i] << endl;
+                    log << transition_varname("vb_", ctx.sigs[ctx.from[i]], ctx.sigs[ctx.to[i]]) << " = " << soln[i] << endl;
             }
             log << "END SOLUTION" << endl;
+            soln.end();
         }
 
         cplex.end();
-        cmodel.end();
-        env.end();
+        EndModel(cmodel);
+        b.endElements();
+        b.end();
+        ys.endElements();
+        ys.end();
+        pooled.Release();
 
     } catch(IloCplex::Exception e) {
         if (e.getStatus() == CPXERR_NO_SOLN) {
@@ -468,7 +666,7 @@ double promoting_nonmono_distance(const Candidate &w, const Ballots &ballots, co
 }
 
 
-double demoting_nonmono_distance(const Candidate &target_cand, const Ballots &ballots, const Candidates &cand, const Config &config, NMNode &node,
+double demoting_nonmono_distance(const NMContext &ctx, const Candidates &cand, const Config &config, NMNode &node,
                                  double upperbound, double tleft, ofstream &log, bool dolog, bool &timeout) {
 
     double dist = -1.;
@@ -480,94 +678,73 @@ double demoting_nonmono_distance(const Candidate &target_cand, const Ballots &ba
             print_elim_order_string(elim_order, cand, auxstr);
             log << "INFO: Entering nonmono distance with (possibly partial) elimination sequence: " << auxstr << endl;
         }
-        // convert Ballots to a map signature->count
-        Sig2N sig2n;
-        ballots_to_sigcounts(ballots, sig2n);
-
         double lb = max(0.0, node.dist);
         double ub = max(lb, upperbound);  // ub may be revised later if upperbound < 0
 
-        IloEnv env;
+        PooledEnv pooled;
+        IloEnv env = pooled.Env();
         IloModel cmodel(env);
 
-        Sig2Sig D;
-        get_demotion_set(target_cand, ballots, cand, D);
-        // Create a linear array with transition pairs
-        vector<Sig2SigPair> sig2sig_pairs;
-        for(Sig2Sig::const_iterator i = D.cbegin(); i != D.cend(); ++i) {
-            for (set<Ints>::iterator auxi = i->second.begin(); auxi != i->second.end(); ++auxi) {
-                sig2sig_pairs.push_back(make_pair(i->first, *auxi));
-                // at this time, also expand signature-count map to add signatures that are new (with count=0)
-                if (sig2n.find(*auxi) == sig2n.end())
-                    sig2n[*auxi] = 0.;
-            }
-        }
-
-        IloNumVarArray d(env, sig2sig_pairs.size());
-        IloNumVarArray ys(env, sig2n.size());
+        IloNumVarArray d(env, ctx.from.size());
+        IloNumVarArray ys(env, ctx.sigs.size());
 
-        char varname[1000];
+        const bool names = dolog && config.debug;
+        string varname;
 
         IloExpr obj(env);
         IloExpr balance(env);
         int i;
 
-        // define ILP d_s1_s2 transitions. D variables are indexed shadowing sig2sig_pairs vector order
-        int total_n = 0;
-        for(i = 0; i < sig2sig_pairs.size(); ++i) {
+        // define ILP d_s1_s2 transitions. D variables are indexed shadowing ctx.from/ctx.to order
+        for(i = 0; i < ctx.from.size(); ++i) {
             // d_s1_s2 - the demoting transition between two signatures. indexed via sig2sig_it vector
-            int ns = (int) sig2n[sig2sig_pairs[i].first]; // original signature count
-            sprintf(varname, "vd_%s", (join(sig2sig_pairs[i].first.begin(), sig2sig_pairs[i].first.end(), "")+\
-                "_" + join(sig2sig_pairs[i].second.begin(), sig2sig_pairs[i].second.end(), "")).c_str());
-            d[i] = IloNumVar(env, 0, ns, ILOINT, varname);
+            int ns = (int) ctx.counts[ctx.from[i]]; // original signature count
+            if (names)
+                varname = transition_varname("vd_", ctx.sigs[ctx.from[i]], ctx.sigs[ctx.to[i]]);
+            d[i] = IloNumVar(env, 0, ns, ILOINT, names ? varname.c_str() : NULL);
             obj += d[i];
-            total_n += ns;
             if (dolog && config.debug) {
                 log << "DEBUG: (var, sig, sig): " << varname << ", (" << \
-                join(sig2sig_pairs[i].first.begin(),sig2sig_pairs[i].first.end()) << "), (" << \
-                join(sig2sig_pairs[i].second.begin(),sig2sig_pairs[i].second.end()) << "), " << endl;
+                join(ctx.sigs[ctx.from[i]].begin(),ctx.sigs[ctx.from[i]].end()) << "), (" << \
+                join(ctx.sigs[ctx.to[i]].begin(),ctx.sigs[ctx.to[i]].end()) << "), " << endl;
             }
         }
         // over all unique signatures
         // collect sums over outgoing and incoming
-        Sig2N::const_iterator it;
-        for(i = 0, it = sig2n.cbegin(); i < sig2n.size(); ++i, ++it) {
-            IloExpr sum_s1(env);
-            bool sum_s1_empty = true;
+        for(i = 0; i < ctx.sigs.size(); ++i) {
+            const Ints &sig = ctx.sigs[i];
             // outgoing
-            for (int j = 0; j < sig2sig_pairs.size(); ++j)
-                if (sig2sig_pairs[j].first == it->first) {
-                    sum_s1 += d[j];
-                    sum_s1_empty = false;
-                }
+            IloExpr sum_s1(env);
+            for (int j = ctx.out_start[i]; j < ctx.out_start[i+1]; ++j)
+                sum_s1 += d[ctx.out_edges[j]];
 
             // incoming
             IloExpr sum_s2(env);
-            for (int j = 0; j < sig2sig_pairs.size(); ++j)
-                if (sig2sig_pairs[j].second == it->first) {
-                    sum_s2 += d[j];
-                }
-            int ns = (int) it->second;
-//            sprintf(varname, "vys_%d", i);
-            sprintf(varname, "vys_%s", (join(it->first.begin(), it->first.end(), "").c_str()));
-            ys[i] = IloNumVar(env, 0, total_n, ILOINT, varname);
+            for (int j = ctx.in_start[i]; j < ctx.in_start[i+1]; ++j)
+                sum_s2 += d[ctx.in_edges[j]];
+            int ns = (int) ctx.counts[i];
+            if (names)
+                varname = signature_varname("vys_", sig);
+            ys[i] = IloNumVar(env, 0, ctx.total_n, ILOINT, names ? varname.c_str() : NULL);
             if (dolog && config.debug) {
                 log << "DEBUG: (var corresponds to sig, n): " << varname << ", (" << \
-                join(it->first.begin(),it->first.end()) << ") " << it->second << endl;
+                join(sig.begin(),sig.end()) << ") " << ctx.counts[i] << endl;
             }
 
             cmodel.add(ns - sum_s1 + sum_s2 == ys[i]);    // balance equation (vote preservation)
-            if (! sum_s1_empty)
+            if (ctx.out_start[i+1] > ctx.out_start[i])
                 cmodel.add(sum_s1 <= ns);
             sum_s1.end();
             sum_s2.end();
         }
         if (upperbound < 0)
-            ub = total_n;
+            ub = ctx.total_n;
         cmodel.add(obj >= lb);
         cmodel.add(obj <= ub);
 
         cmodel.add(IloMinimize(env, obj));
+        obj.end();
+        balance.end();
 
         // enforce elimination order
         set<int> defeated;
@@ -580,8 +757,8 @@ double demoting_nonmono_distance(const Candidate &target_cand, const Ballots &ba
                     continue;
                 IloExpr yopp(env);
                 // we have elim cand and an opponent, look for how many votes goes to each
-                for(i = 0, it = sig2n.begin(); it != sig2n.end(); ++i, ++it)
-                    for(Ints::const_iterator j = (it->first).begin(); j != (it->first).end(); ++j) {
+                for(i = 0; i < ctx.sigs.size(); ++i)
+                    for(Ints::const_iterator j = ctx.sigs[i].begin(); j != ctx.sigs[i].end(); ++j) {
                         if (defeated.find(*j)!=defeated.end())
                             continue; // ignore cands previously eliminated
                         if (*j == e) {
@@ -602,7 +779,9 @@ double demoting_nonmono_distance(const Candidate &target_cand, const Ballots &ba
                     cmodel.add(ye <= yopp);
                 else
                     cmodel.add(ye <= yopp - 0.01);
+                yopp.end();
             }
+            ye.end();
             // this cand is now eliminated
             defeated.insert(e);
         }
@@ -646,14 +825,19 @@ double demoting_nonmono_distance(const Candidate &target_cand, const Ballots &ba
             log << "SOLUTION (non-zero only) = " << endl;
             for(i=0; i<d.getSize(); ++i) {
                 if (soln[i] > 0)
-                    log << d[i].getName() << " = " << soln[i] << endl;
+                    log << transition_varname("vd_", ctx.sigs[ctx.from[i]], ctx.sigs[ctx.to[i]]) << " = " << soln[i] << endl;
             }
             log << "END SOLUTION" << endl;
+            soln.end();
         }
 
         cplex.end();
-        cmodel.end();
-        env.end();
+        EndModel(cmodel);
+        d.endElements();
+        d.end();
+        ys.endElements();
+        ys.end();
+        pooled.Release();
 
     } catch(IloCplex::Exception e) {
         if (e.getStatus() == CPXERR_NO_SOLN) {
@@ -681,8 +865,7 @@ double demoting_nonmono_distance(const Candidate &target_cand, const Ballots &ba
 }
 
 
-double participation_failure_distance(int mode, const Candidate &target_cand, const Candidate &irv_winner,
-                                      const Ballots &ballots, const Candidates &cand, const Config &config,
+double participation_failure_distance(int mode, const NMContext &ctx, const Candidates &cand, const Config &config,
                                       NMNode &node, double upperbound, double tleft, ofstream &log, bool dolog,
                                       bool &timeout) {
     /*
@@ -701,73 +884,63 @@ double participation_failure_distance(int mode, const Candidate &target_cand, co
                 << auxstr << endl;
         }
 
-        // create signatures-counts map
-        Sig2N sig2n;
-        ballots_to_sigcounts(ballots, sig2n);
-
         double lb = max(0.0, node.dist);
         double ub = max(lb, upperbound);  // ub may be revised later if upperbound < 0
 
-        IloEnv env;
+        PooledEnv pooled;
+        IloEnv env = pooled.Env();
         IloModel cmodel(env);
 
-        set<Ints> S;
-        get_bottom_set(target_cand, cand, S);
-        // add possibly zero-count combinations to sig2n
-        set<Ints>::const_iterator it;
-        for (it = S.begin(); it != S.end(); ++it)
-            if (sig2n.find(*it) == sig2n.end())
-                sig2n.insert(make_pair<Ints, double>(*it, 0.0));
+        IloNumVarArray a(env, ctx.nvars);
+        IloNumVarArray ys(env, ctx.nvars);
 
-        IloNumVarArray a(env, S.size());
-        IloNumVarArray ys(env, S.size());
-
-        char varname[1000];
+        const bool names = dolog && config.debug;
+        string varname;
 
         IloExpr obj(env);
         IloExpr balance(env);
 
-        // define ILP
-        int total_n = 0;
+        // define ILP. The context has already decided which signatures get
+        // an ILP variable (only the bottom patterns) and its index.
+        const int total_n = ctx.total_n;
         int i;
-        map<Ints, int> sig2ILPid; // keeps track of which ILP variable index belongs to which signature
-        Sig2N::const_iterator si;
-        for(si = sig2n.begin(); si != sig2n.end(); ++si)
-            total_n += si->second;
-        for(i=0, si = sig2n.begin(); si != sig2n.end(); ++si) {
-            int ns = si->second;
-            // while we go over all signatures, we only define ILP vars for the bottom patterns
-            if (S.find(si->first) != S.end()) {// this is a relevant target signature
-                sig2ILPid.insert(make_pair(si->first, i));
-                sprintf(varname, "ys_%s", join(si->first.begin(), si->first.end(), "").c_str());
-                ys[i] = IloNumVar(env, 0, 2*total_n, ILOINT, varname);
-                if (dolog && config.debug) {
-                    log << "DEBUG: (var, sig): " << varname << ", (" << \
-                     join(si->first.begin(), si->first.end(), "") << ")" << endl;
-                }
-                // a_s is the count of signatures where target is bottom/top (dep. on mode) added/subtracted
-                sprintf(varname, "va_%s", join(si->first.begin(), si->first.end(), "").c_str());
-                switch (mode) {
-                    case MODE_PARTICIPATION_ADD_L_BOTTOM:
-                        a[i] = IloNumVar(env, 0, total_n, ILOINT, varname); // note UB
-                        cmodel.add(ys[i] == ns + a[i]);
-                        break;
-                    case MODE_PARTICIPATION_REMOVE_W_BOTTOM:
-                        a[i] = IloNumVar(env, 0, ns, ILOINT, varname);
-                        cmodel.add(ys[i] == ns - a[i]);
-                        break;
-                    default:
-                        throw STVException("ERROR: Unknown mode in participation_failure_distance()");
-                }
-                obj += a[i];
-                i++;  // important!
-            } else {
-                sig2ILPid.insert(make_pair(si->first, -1));
+        vector<int> ILPid2sig(ctx.nvars); // which signature each ILP variable index belongs to
+        for(int si = 0; si < ctx.sigs.size(); ++si) {
+            i = ctx.ilpid[si];
+            if (i < 0)
+                continue;
+            const Ints &sig = ctx.sigs[si];
+            int ns = ctx.counts[si];
+            ILPid2sig[i] = si;
+            if (names)
+                varname = signature_varname("ys_", sig);
+            ys[i] = IloNumVar(env, 0, 2*total_n, ILOINT, names ? varname.c_str() : NULL);
+            if (dolog && config.debug) {
+                log << "DEBUG: (var, sig): " << varname << ", (" << \
+                 join(sig.begin(), sig.end(), "") << ")" << endl;
+            }
+            // a_s is the count of signatures where target is bottom/top (dep. on mode) added/subtracted
+            if (names)
+                varname = signature_varname("va_", sig);
+            switch (mode) {
+                case MODE_PARTICIPATION_ADD_L_BOTTOM:
+                    a[i] = IloNumVar(env, 0, total_n, ILOINT, names ? varname.c_str() : NULL); // note UB
+                    cmodel.add(ys[i] == ns + a[i]);
+                    break;
+                case MODE_PARTICIPATION_REMOVE_W_BOTTOM:
+                    a[i] = IloNumVar(env, 0, ns, ILOINT, names ? varname.c_str() : NULL);
+                    cmodel.add(ys[i] == ns - a[i]);
+                    break;
+                default:
+                    throw STVException("ERROR: Unknown mode in participation_failure_distance()");
             }
+            obj += a[i];
         }
         cmodel.add(obj >= lb);
         cmodel.add(obj <= ub);
         cmodel.add(IloMinimize(env, obj));
+        obj.end();
+        balance.end();
 
         // enforce elimination order
         set<int> defeated;
@@ -780,10 +953,10 @@ double participation_failure_distance(int mode, const Candidate &target_cand, co
                     continue;
                 IloExpr yopp(env);
                 // we have elim cand and an opponent, look for how many votes goes to each
-                for(si = sig2n.begin(); si != sig2n.end(); ++si) {
-                    int ilp_var_index = sig2ILPid[si->first];  // <0 indicates not defined
-                    int ns = (int) (si->second);
-                    for (Ints::const_iterator j = (si->first).begin(); j != (si->first).end(); ++j) {
+                for(int si = 0; si < ctx.sigs.size(); ++si) {
+                    int ilp_var_index = ctx.ilpid[si];  // <0 indicates not defined
+                    int ns = (int) (ctx.counts[si]);
+                    for (Ints::const_iterator j = ctx.sigs[si].begin(); j != ctx.sigs[si].end(); ++j) {
                         if (defeated.find(*j) != defeated.end())
                             continue; // ignore cands previously eliminated
                         if (*j == e) {
@@ -811,7 +984,9 @@ double participation_failure_distance(int mode, const Candidate &target_cand, co
                     cmodel.add(ye <= yopp);
                 else
                     cmodel.add(ye <= yopp - 0.01);
+                yopp.end();
             }
+            ye.end();
             // this cand is now eliminated
             defeated.insert(e);
         }
@@ -855,14 +1030,19 @@ double participation_failure_distance(int mode, const Candidate &target_cand, co
             log << "SOLUTION (non-zero only) = " << endl;
             for(i=0; i<a.getSize(); ++i) {
                 if (soln[i] > 0)
-                    log << a[i].getName() << " = " << soln[i] << endl;
+                    log << signature_varname("va_", ctx.sigs[ILPid2sig[i]]) << " = " << soln[i] << endl;
             }
             log << "END SOLUTION" << endl;
+            soln.end();
         }
 
         cplex.end();
-        cmodel.end();
-        env.end();
+        EndModel(cmodel);
+        a.endElements();
+        a.end();
+        ys.endElements();
+        ys.end();
+        pooled.Release();
 
     } catch(IloCplex::Exception e) {
         if (e.getStatus() == CPXERR_NO_SOLN) {
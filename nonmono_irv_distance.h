@@ -6,21 +6,77 @@
 #define _NONMONO_IRV_DISTANCE_H
 
 #include "model.h"
-typedef std::map<Ints, std::set<Ints> > Sig2Sig;
-typedef std::pair<Ints, Ints> Sig2SigPair;
-typedef std::map<Ints, double> Sig2N;
 #define MODE_PARTICIPATION_REMOVE_W_BOTTOM 1
 #define MODE_PARTICIPATION_ADD_L_BOTTOM 0
 
+// Interning table for signatures (preference lists), handing out dense ids
+// 0, 1, ... in order of first insertion. Each signature is packed into a
+// fixed-width key (4 bits per candidate for up to 16 candidates, wider
+// beyond, plus its length) and found by open addressing on that key, so
+// no vector is allocated or compared per lookup.
+class SigTable {
+    private:
+        int width;       // bits per candidate
+        int perword;     // candidates per 64-bit word
+        int maxlen;      // longest signature that can be stored
+        int stride;      // words per key (the first holds the length)
+        std::vector<unsigned long long> keys;  // packed key of id i at keys[i*stride]
+        std::vector<int> slots;                // ids, or -1 if empty; size is a power of 2
+        std::vector<unsigned long long> buffer;  // key being looked up
+
+        template<typename InputIt>
+        void Pack(InputIt first, InputIt last, unsigned long long *key) const;
+        size_t Hash(const unsigned long long *key) const;
+        int Insert(const unsigned long long *key);
+        void Grow();
+
+    public:
+        SigTable(int ncandidates);
+
+        // Id of the signature, adding it if it is not in the table.
+        int Intern(const Ints &sig);
+        int Intern(const Pref *first, const Pref *last);
+
+        int Size() const { return keys.size() / stride; }
+
+        // Unpack signature 'id' into 'sig'.
+        void Get(int id, Ints &sig) const;
+};
+
+// Signature transitions, as (source, target) SigTable ids
+typedef std::vector<std::pair<int, int> > SigEdges;
+
+// The part of a nonmonotonicity/participation ILP that does not depend on the
+// elimination sequence of a node. It is built once per search (by one of the
+// build_*_context functions) and shared by all distance calls of that search.
+struct NMContext {
+    std::vector<Ints> sigs;          // all signatures, in lexicographic order; ys[i] is the count of sigs[i]
+    Doubles counts;                  // original count of each signature (0 for new signatures)
+    Ints from, to;                   // index (into sigs) of each transition's source and target signature,
+                                     // ordered by source and then target; indexed like their ILP variables
+    // Transitions leaving signature s are out_edges[out_start[s]] to out_edges[out_start[s+1]-1],
+    // in increasing order (and likewise for the transitions entering s).
+    Ints out_start, out_edges;
+    Ints in_start, in_edges;
+    Ints ilpid;                      // participation only: ILP variable of each signature (-1 if none)
+    int nvars;                       // participation only: number of ILP variables
+    int total_n;                     // upper bound on signature counts in the ILP
+};
+
+void build_promoting_context(const Candidate &w, const Ballots &ballots, const Config &config, NMContext &ctx);
+void build_demoting_context(const Candidate &target_cand, const Ballots &ballots, const Candidates &cand,
+                            const Config &config, NMContext &ctx);
+void build_participation_context(const Candidate &target_cand, const Ballots &ballots, const Candidates &cand,
+                                 const Config &config, NMContext &ctx);
+
 //double distance(const Ballots &ballots, const Candidates &cand,
 //	const Config &config, Node &node, double upperbound,
 //	double tleft,  std::ofstream &log, bool dolog, bool &timeout);
-double promoting_nonmono_distance(const Candidate &w, const Ballots &ballots, const Candidates &cand, const Config &config, NMNode &node,
+double promoting_nonmono_distance(const NMContext &ctx, const Candidates &cand, const Config &config, NMNode &node,
                                   double upperbound, double tleft, std::ofstream &log, bool dolog, bool &timeout);
-double demoting_nonmono_distance(const Candidate &target_cand, const Ballots &ballots, const Candidates &cand, const Config &config, NMNode &node,
+double demoting_nonmono_distance(const NMContext &ctx, const Candidates &cand, const Config &config, NMNode &node,
                                  double upperbound, double tleft, std::ofstream &log, bool dolog, bool &timeout);
-double participation_failure_distance(int mode, const Candidate &target_cand, const Candidate &irv_winner,
-                                      const Ballots &ballots, const Candidates &cand, const Config &config,
+double participation_failure_distance(int mode, const NMContext &ctx, const Candidates &cand, const Config &config,
                                       NMNode &node, double upperbound, double tleft, std::ofstream &log, bool dolog,
                                       bool &timeout);
 // useful print routine
@@ -156,6 +156,10 @@ double RunPromotingNonmonoTreeIRV(const Ballots &ballots, const Candidates &cand
 
         bool dolog = log.is_open();
 
+        // Signatures and transitions do not depend on the node being evaluated
+        NMContext ctx;
+        build_promoting_context(irv_winner, ballots, config, ctx);
+
         // BUILD FRINGE: Initialize with each of the candidates as first to be eliminated
         for (int i = 0; i < cands.size(); ++i) {
             NMNode newn(irv_winner.index);  // reference_target is passed for later reference
@@ -229,7 +233,7 @@ double RunPromotingNonmonoTreeIRV(const Ballots &ballots, const Candidates &cand
                     continue;
                 }
 
-                child.dist = promoting_nonmono_distance(irv_winner, ballots, cands, config, child,
+                child.dist = promoting_nonmono_distance(ctx, cands, config, child,
                                                         curr_ubound, tleft, log, dolog, timeout);
                 if (child.dist == -2) {
                     return -2;
@@ -345,6 +349,10 @@ double RunDemotingNonmonoTreeIRV(const Ballots &ballots, const Candidates &cands
 
         bool dolog = log.is_open();
 
+        // Signatures and transitions do not depend on the node being evaluated
+        NMContext ctx;
+        build_demoting_context(demotion_target, ballots, cands, config, ctx);
+
         // BUILD FRINGE: Initialize with each of the candidates except target as first to be eliminated
         for (int i = 0; i < cands.size(); ++i) {
             if (i == demotion_target.index)
@@ -420,7 +428,7 @@ double RunDemotingNonmonoTreeIRV(const Ballots &ballots, const Candidates &cands
                     continue;
                 }
 
-                child.dist = demoting_nonmono_distance(demotion_target, ballots, cands, config, child,
+                child.dist = demoting_nonmono_distance(ctx, cands, config, child,
                                                         curr_ubound, tleft, log, dolog, timeout);
                 if (child.dist == -2) {
                     return -2;
@@ -546,6 +554,10 @@ double RunBottomManipulationTreeIRV(int mode, const Ballots &ballots, const Cand
 
         bool dolog = log.is_open();
 
+        // Signatures do not depend on the node being evaluated
+        NMContext ctx;
+        build_participation_context(target, ballots, cands, config, ctx);
+
         // BUILD FRINGE: Initialize with each of the candidates
         // except the target (which is the loser that should win) as first to be eliminated (this only in MODE_PARTICIPATION_ADD_L_BOTTOM)
         // In contrast, in MODE_PARTICIPATION_REMOVE_W_BOTTOM, anybody can be eliminated as first.
@@ -633,7 +645,7 @@ double RunBottomManipulationTreeIRV(int mode, const Ballots &ballots, const Cand
                     continue;
                 }
 
-                child.dist = participation_failure_distance(mode, target, irv_winner, ballots, cands, config,
+                child.dist = participation_failure_distance(mode, ctx, cands, config,
                                                             child,
                                                             curr_ubound, tleft, log, dolog, timeout);
                 if (child.dist == -2) {
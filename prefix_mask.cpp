@@ -0,0 +1,117 @@
+/*
+    Copyright (C) 2016-2019  Michelle Blom
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include<cmath>
+#include "prefix_mask.h"
+
+#ifdef __AVX2__
+#include<immintrin.h>
+#endif
+
+using namespace std;
+
+bool PrefixMasks::Build(const BallotStore &store, int ncandidates, int c){
+	before.clear();
+	votes.clear();
+
+	if(ncandidates > MAX_TREE_CANDIDATES){
+		return false;
+	}
+
+	before.reserve(store.Size());
+	votes.reserve(store.Size());
+	for(int b = 0; b < store.Size(); ++b){
+		if(store.votes[b] != floor(store.votes[b])){
+			before.clear();
+			votes.clear();
+			return false;
+		}
+
+		CandMask mask = 0;
+		for(const Pref *jt = store.Begin(b); jt != store.End(b); ++jt){
+			if(*jt == c){
+				before.push_back(mask);
+				votes.push_back(store.votes[b]);
+				break;
+			}
+			mask |= CandMask(1) << *jt;
+		}
+	}
+
+	return true;
+}
+
+bool PrefixMaskSet::Build(const BallotStore &store, int ncandidates){
+	masks.clear();
+
+	if(ncandidates > MAX_TREE_CANDIDATES){
+		return false;
+	}
+
+	for(int b = 0; b < store.Size(); ++b){
+		if(store.votes[b] != floor(store.votes[b])){
+			return false;
+		}
+	}
+
+	masks.resize(ncandidates);
+	for(int b = 0; b < store.Size(); ++b){
+		CandMask mask = 0;
+		for(const Pref *jt = store.Begin(b); jt != store.End(b); ++jt){
+			if((mask >> *jt) & 1) continue;
+
+			PrefixMasks &m = masks[*jt];
+			m.before.push_back(mask);
+			m.votes.push_back(store.votes[b]);
+			mask |= CandMask(1) << *jt;
+		}
+	}
+
+	return true;
+}
+
+double PrefixMasks::Count(CandMask block) const{
+	const int n = before.size();
+	double total = 0;
+	int i = 0;
+
+	#ifdef __AVX2__
+	const __m256i vblock = _mm256_set1_epi64x(block);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256d sum = _mm256_setzero_pd();
+	for(; i + 4 <= n; i += 4){
+		const __m256i m = _mm256_loadu_si256((const __m256i*)&before[i]);
+		const __m256i pass = _mm256_cmpeq_epi64(
+			_mm256_and_si256(m, vblock), zero);
+		const __m256d v = _mm256_loadu_pd(&votes[i]);
+		sum = _mm256_add_pd(sum, _mm256_and_pd(v, 
+			_mm256_castsi256_pd(pass)));
+	}
+
+	double lanes[4];
+	_mm256_storeu_pd(lanes, sum);
+	total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	#endif
+
+	for(; i < n; ++i){
+		if((before[i] & block) == 0){
+			total += votes[i];
+		}
+	}
+
+	return total;
+}
@@ -0,0 +1,72 @@
+/*
+    Copyright (C) 2016-2019  Michelle Blom
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _PREFIX_MASK_H
+#define _PREFIX_MASK_H
+
+#include<vector>
+#include "model.h"
+
+// Ballot signatures that rank a given candidate 'c', each with a mask of
+// the candidates ranked before 'c' on it. A signature counts toward 'c' 
+// when only 'c' and the candidates in some set remain if and only if its
+// mask has no candidate of that set, so the scoring rules can count the
+// votes for each set with one mask test per signature rather than by
+// walking its preferences. 
+//
+// Count() tests four signatures at a time with AVX2 instructions when the
+// program is compiled for them (e.g. with -mavx2), and one at a time
+// otherwise.
+class PrefixMasks{
+	friend class PrefixMaskSet;
+
+	private:
+		std::vector<CandMask> before;
+		Doubles votes;
+
+	public:
+		// Build masks for the signatures in 'store' that rank candidate 
+		// 'c'. Returns false (and builds nothing) if there are more than
+		// MAX_TREE_CANDIDATES candidates or a signature has a fractional 
+		// number of votes: Count() adds votes in a different order to the
+		// scoring rules, so its totals are only the same for whole votes.
+		bool Build(const BallotStore &store, int ncandidates, int c);
+
+		// Total votes of signatures that rank 'c' above every candidate
+		// in 'block'.
+		double Count(CandMask block) const;
+
+		int Size() const { return before.size(); }
+};
+
+// PrefixMasks for every candidate, built with one pass over a profile and
+// then shared (read only) by the search workers.
+class PrefixMaskSet{
+	private:
+		std::vector<PrefixMasks> masks;
+
+	public:
+		// Build masks for each candidate. Returns false (and builds 
+		// nothing) in the same cases as PrefixMasks::Build.
+		bool Build(const BallotStore &store, int ncandidates);
+
+		// Masks for the signatures that rank candidate 'c'
+		const PrefixMasks& For(int c) const { return masks[c]; }
+};
+
+#endif
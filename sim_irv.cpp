@@ -21,141 +21,161 @@
 
 using namespace std;
 
-int NextCandidate(const Ballot &b, int id, const Candidates &cand);
-
-int SimIRV(const Ballots &ballots, const Doubles &votecounts, int &winner, 
-	Candidates &cand,const Config &config,Ints &order_c,bool log)
+// Simulation proceeds as follows. Each ballot has a cursor into its list
+// of preferences, pointing to the candidate it currently counts toward,
+// and sits in that candidate's pile. When a candidate is eliminated, the
+// cursor of each ballot in their pile is moved forward to the next 
+// candidate still standing, and the ballot is moved to that candidate's 
+// pile. Cursors only move forward, so the whole count takes time linear
+// in the total length of all ballots.
+void SimulateIRV(const Ballots &ballots, const Doubles &votecounts,
+	const Candidates &cand, const Config &config, SimWorkspace &ws,
+	SimResult &result, ostream *log)
 {
-	int last_round_margin = 0;
 	try	{
-		if(log) cout << "First preference tallies: " << endl;
+		const BallotStore &store = GetBallotStore(ballots, config);
+		const int ncand = cand.size();
+
+		Ints &tally = ws.tally;
+		Ints &standing = ws.standing;
+		Ints2d &piles = ws.piles;
+		Ints &cursor = ws.cursor;
+		Ints &transferred = ws.transferred;
+		Ints &ntransferred = ws.ntransferred;
+
+		tally.assign(ncand, 0);
+		standing.assign(ncand, 1);
+		piles.resize(ncand);
+		for(int c = 0; c < ncand; ++c){
+			piles[c].clear();
+		}
+		cursor.assign(store.Size(), 0);
+		transferred.assign(ncand, 0);
+		ntransferred.assign(ncand, 0);
 
-		int lowest_idx = -1;
-		int lowest_votes = 0;
+		result.winner = -1;
+		result.order_c.clear();
+		result.tallies.clear();
+		result.last_round_margin = 0;
 
-		// First compute initial tallies
-		for(int c = 0; c < cand.size(); ++c){
-			Candidate &ct = cand[c];
-			ct.sim_votes = 0;
-			ct.standing = 1;
+		if(log) *log << "First preference tallies: " << endl;
 
+		// First compute initial tallies
+		for(int c = 0; c < ncand; ++c){
+			const Candidate &ct = cand[c];
 			for(Ints::const_iterator li = ct.ballots.begin();
 				li != ct.ballots.end(); ++li){
-				ct.sim_votes += votecounts[*li];
-				ct.sim_ballots.push_back(*li);
-			}
-
-			if(lowest_idx == -1 || ct.sim_votes < lowest_votes){
-				lowest_idx = c;
-				lowest_votes = ct.sim_votes;
+				tally[c] += votecounts[*li];
+				piles[c].push_back(*li);
 			}
 
 			if(log){
-				cout << "  Candidate " << ct.name << " " << ct.sim_votes << endl;
+				*log << "  Candidate " << ct.name << " " << tally[c] << endl;
 			}
 		}
 
 		if(log)
-			cout << endl;
+			*log << endl;
 
 		// Eliminate candidate with smallest tally, until there is
 		// only 1 candidate left -- the winner.
-		for(int r = 0; r < cand.size() - 1; ++r){
+		for(int r = 0; r < ncand - 1; ++r){
+			result.tallies.push_back(tally);
+
 			// Eliminate candidate with the least votes
 			int lowest_votes = -1;
 			int lowest_idx = -1;
 
-			for(int c = 0; c < cand.size(); ++c){
-				const Candidate &ct = cand[c];
-
-				if(ct.standing == 0){
+			for(int c = 0; c < ncand; ++c){
+				if(standing[c] == 0){
 					continue;
 				}
 
-				if(lowest_idx == -1 || ct.sim_votes < lowest_votes){
+				if(lowest_idx == -1 || tally[c] < lowest_votes){
 					lowest_idx = c;
-					lowest_votes = ct.sim_votes;
+					lowest_votes = tally[c];
 				}
 			}
 
-			Candidate &e = cand[lowest_idx];
-			order_c.push_back(lowest_idx);
+			const Candidate &e = cand[lowest_idx];
+			result.order_c.push_back(lowest_idx);
 
 			if(log){
-				cout << "Round " << r << ", Candidate " <<
+				*log << "Round " << r << ", Candidate " <<
                      e.name << " eliminated." << endl;
 			}
 
-			e.standing = 0;
+			standing[lowest_idx] = 0;
 
-			if(r == cand.size() - 2){
+			if(r == ncand - 2){
 				// one candidate remains -- the winner
-				last_round_margin = lowest_votes;
+				result.last_round_margin = lowest_votes;
 				break;
 			}
 
-			Ints2d totransfer(cand.size());
-
-			for(Ints::iterator it = e.sim_ballots.begin();
-				it != e.sim_ballots.end(); ++it){
-				int next = NextCandidate(ballots[*it],lowest_idx,cand);
-
-				if(next >= 0){
-					totransfer[next].push_back(*it);
+			Ints &pile = piles[lowest_idx];
+			for(Ints::const_iterator it = pile.begin(); it != pile.end(); 
+				++it){
+				const int b = *it;
+				const Pref *prefs = store.Begin(b);
+				const int len = store.End(b) - prefs;
+
+				int &pos = cursor[b];
+				for(++pos; pos < len && standing[prefs[pos]] == 0; ++pos);
+
+				if(pos < len){
+					const int next = prefs[pos];
+					transferred[next] += votecounts[b];
+					++ntransferred[next];
+					piles[next].push_back(b);
 				}
 			}
 
-			e.sim_votes = 0;
+			pile.clear();
+			tally[lowest_idx] = 0;
 
-			for(int i = 0; i < totransfer.size(); ++i){
-				const Ints &list = totransfer[i];
-				if(list.empty()) continue;
+			for(int i = 0; i < ncand; ++i){
+				if(ntransferred[i] == 0) continue;
 			
-				Candidate &ct = cand[i];
-				int total = 0;
-				for(int j = 0; j < list.size(); ++j){
-					total += votecounts[list[j]];
-					ct.sim_ballots.push_back(list[j]);
-				}
-
-				ct.sim_votes += total;
+				tally[i] += transferred[i];
 				if(log) {
-					cout << total << " votes distributed from " << e.name <<
-                         " to " << ct.name << endl;
+					*log << transferred[i] << " votes distributed from " << 
+						e.name << " to " << cand[i].name << endl;
 				}
+
+				transferred[i] = 0;
+				ntransferred[i] = 0;
 			}
 			if(log){
-				for(int c = 0; c < cand.size(); ++c){
-					Candidate &ct = cand[c];
-					if(ct.standing == 1){
-						cout << "  Candidate " << ct.name << " " <<
-                             ct.sim_votes << endl;
+				for(int c = 0; c < ncand; ++c){
+					if(standing[c] == 1){
+						*log << "  Candidate " << cand[c].name << " " <<
+                             tally[c] << endl;
 					}
 				}
-				cout << endl;
+				*log << endl;
 			}
 		}
 		
-
-		for(int c = 0; c < cand.size(); ++c){
-			const Candidate &ct = cand[c];
-			if(ct.standing == 1){
-				order_c.push_back(c);
-				last_round_margin = ct.sim_votes - last_round_margin;
-				winner = c;
+		for(int c = 0; c < ncand; ++c){
+			if(standing[c] == 1){
+				result.order_c.push_back(c);
+				result.last_round_margin = tally[c] - 
+					result.last_round_margin;
+				result.winner = c;
 				if(log){
-					cout << "Candidate " << ct.name << " elected." << endl;
+					*log << "Candidate " << cand[c].name << " elected." << endl;
 				}
 				break;
 			}
 		}
 
 		if(log){
-			cout << "Elimination order: ";
-			for(int i = 0; i < order_c.size(); ++i){
-				cout << order_c[i] << " ";
+			*log << "Elimination order: ";
+			for(int i = 0; i < result.order_c.size(); ++i){
+				*log << result.order_c[i] << " ";
 			}
-			cout << endl;
+			*log << endl;
 		}
 	}
 	catch(STVException &e)
@@ -167,32 +187,26 @@ int SimIRV(const Ballots &ballots, const Doubles &votecounts, int &winner,
 		throw STVException("Unexpected error in IRV simulation.");
 	}
 
-	if(log) cout << "Simulation complete" << endl << endl;
-	return last_round_margin;
+	if(log) *log << "Simulation complete" << endl << endl;
 }
 
-// Determines the next eligible candidate in b.prefs, after 'index'.
-int NextCandidate(const Ballot &b, int index, const Candidates &cand)
+int SimIRV(const Ballots &ballots, const Doubles &votecounts, int &winner, 
+	Candidates &cand,const Config &config,Ints &order_c,bool log)
 {
-	try{
-		int idx = find(b.prefs.begin(), b.prefs.end(), index)-b.prefs.begin();
-	
-		for(int i = idx+1; i < b.prefs.size(); ++i){
-			if(cand[b.prefs[i]].standing == 0) 
-				continue;
-
-			return b.prefs[i];
-		}
-
-		return -1;
-	}
-	catch(exception &e){
-		throw STVException(string(e.what()));
-	}
-	catch(...){
-		throw STVException("Unexpected error in NextCandidate.");
+	SimWorkspace ws;
+	SimResult result;
+	SimulateIRV(ballots, votecounts, cand, config, ws, result, 
+		log ? &cout : NULL);
+
+	// Final state of the count
+	for(int c = 0; c < cand.size(); ++c){
+		cand[c].sim_votes = ws.tally[c];
+		cand[c].standing = ws.standing[c];
+		cand[c].sim_ballots.swap(ws.piles[c]);
 	}
 
-	return -1;
+	winner = result.winner;
+	order_c.insert(order_c.end(), result.order_c.begin(), 
+		result.order_c.end());
+	return result.last_round_margin;
 }
-
@@ -19,12 +19,61 @@
 #ifndef _SIM_IRV_H
 #define _SIM_IRV_H
 
+#include<ostream>
 #include "model.h"
 
+// Outcome of an IRV count.
+struct SimResult
+{
+	int winner;
+
+	// Candidates in the order in which they were eliminated, with the 
+	// winner last.
+	Ints order_c;
+
+	// tallies[r][c]: tally of candidate 'c' in round 'r', when order_c[r]
+	// is eliminated (0 for candidates eliminated in earlier rounds).
+	Ints2d tallies;
+
+	// Difference between the tallies of the two candidates remaining in
+	// the last round (x2 the last round margin).
+	int last_round_margin;
+
+	SimResult() : winner(-1), last_round_margin(0) {}
+};
+
+// Scratch state used by SimulateIRV. A workspace can be reused across
+// calls, but not shared by concurrent calls.
+struct SimWorkspace
+{
+	Ints tally;
+	Ints standing;
+
+	// Ballots counting toward each candidate, and the position in each
+	// ballot's preferences of the candidate it counts toward.
+	Ints2d piles;
+	Ints cursor;
+
+	// Transfers out of the candidate eliminated in a round
+	Ints transferred;
+	Ints ntransferred;
+};
+
+// Simulate IRV counting algorithm for given election, with given ballots,
+// votes per ballot (votecounts), and candidates. Nothing but 'ws' and 
+// 'result' is modified, so concurrent calls are safe as long as each has
+// its own workspace. If 'log' is not NULL, round-by-round counts are 
+// printed to it.
+void SimulateIRV(const Ballots &ballots, const Doubles &votecounts,
+	const Candidates &cands, const Config &config, SimWorkspace &ws,
+	SimResult &result, std::ostream *log = NULL);
+
 // Simulate IRV counting algorithm for given election, with given ballots,
 // and candidates. The method will return the last round margin (x2), the
 // total tally of each candidate (in votecounts), and the elimination
 // sequence (in elim_seq). Set log to true to print round-by-round counts.
+// The final state of the count is recorded in the sim_votes, standing and
+// sim_ballots members of 'cands'.
 int SimIRV(const Ballots &ballots, const Doubles &votecounts, int &winner,
 	Candidates &cands, const Config &config, Ints &order_c, bool log);
 
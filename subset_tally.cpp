@@ -0,0 +1,238 @@
+/*
+    Copyright (C) 2016-2019  Michelle Blom
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include<algorithm>
+#include<cmath>
+#include "subset_tally.h"
+
+using namespace std;
+
+// Orders signatures lexicographically by their preferences.
+struct SignatureOrder{
+	const BallotStore &store;
+
+	SignatureOrder(const BallotStore &s) : store(s) {}
+
+	bool operator()(int a, int b) const{
+		return lexicographical_compare(store.Begin(a), store.End(a),
+			store.Begin(b), store.End(b));
+	}
+};
+
+// Create nodes for the signatures sigs[lo] to sigs[hi-1], which share 
+// their first 'depth' preferences, and return the number of nodes added
+// at this depth. The nodes for one depth are added next to each other,
+// before any of their children, so that siblings are contiguous.
+int SubsetTallyCache::BuildTrie(const BallotStore &store, Ints &sigs,
+	int lo, int hi, int depth){
+	// Skip signatures that end at this depth
+	while(lo < hi && store.End(sigs[lo]) - store.Begin(sigs[lo]) <= depth){
+		++lo;
+	}
+
+	const int first = nodes.size();
+	Ints bounds;
+	for(int i = lo; i < hi; ){
+		const int c = store.Begin(sigs[i])[depth];
+		TrieNode n;
+		n.cand = c;
+		n.votes = 0;
+		n.first = 0;
+		n.nchildren = 0;
+
+		bounds.push_back(i);
+		for(; i < hi && store.Begin(sigs[i])[depth] == c; ++i){
+			n.votes += store.votes[sigs[i]];
+		}
+		nodes.push_back(n);
+	}
+	bounds.push_back(hi);
+
+	const int count = nodes.size() - first;
+	for(int k = 0; k < count; ++k){
+		const int cfirst = nodes.size();
+		const int nc = BuildTrie(store, sigs, bounds[k], bounds[k+1], 
+			depth+1);
+		nodes[first+k].first = cfirst;
+		nodes[first+k].nchildren = nc;
+	}
+
+	return count;
+}
+
+SubsetTallyCache::SubsetTallyCache(const BallotStore &store, 
+	int ncandidates, size_t maxbytes) : ncand(ncandidates), nroots(0),
+	integral(true){
+	if(ncand > MAX_TREE_CANDIDATES){
+		throw STVException("Too many candidates for subset tally cache.");
+	}
+
+	Ints sigs(store.Size());
+	for(int i = 0; i < sigs.size(); ++i){
+		sigs[i] = i;
+		if(store.votes[i] != floor(store.votes[i])){
+			integral = false;
+		}
+	}
+	sort(sigs.begin(), sigs.end(), SignatureOrder(store));
+
+	nroots = BuildTrie(store, sigs, 0, sigs.size(), 0);
+
+	AboveWithin(0, above);
+
+	// Table of (2^ncand) rows of 'ncand' tallies, plus a state per row
+	if(ncand < 8*sizeof(size_t) - 1){
+		const size_t rows = size_t(1) << ncand;
+		const size_t bytes = rows * (ncand*sizeof(double) + 1);
+		if(bytes / rows == ncand*sizeof(double) + 1 && bytes <= maxbytes){
+			table.resize(rows * ncand);
+			state.reset(new atomic<unsigned char>[rows]);
+			for(size_t i = 0; i < rows; ++i){
+				state[i] = 0;
+			}
+		}
+	}
+}
+
+// Add the votes of ballots passing through sibling nodes nodes[first] to
+// nodes[first+count-1] to the tallies of the alive candidates they count 
+// toward. Ballots only pass through eliminated candidates to get to a 
+// node, so the recursion is no deeper than the number of candidates.
+void SubsetTallyCache::Visit(int first, int count, CandMask alive,
+	double *tallies) const{
+	for(int i = first; i < first + count; ++i){
+		const TrieNode &n = nodes[i];
+		if((alive >> n.cand) & 1){
+			tallies[n.cand] += n.votes;
+		}
+		else if(n.nchildren > 0){
+			Visit(n.first, n.nchildren, alive, tallies);
+		}
+	}
+}
+
+void SubsetTallyCache::Compute(CandMask alive, double *tallies) const{
+	fill(tallies, tallies + ncand, 0.0);
+	Visit(0, nroots, alive, tallies);
+}
+
+void SubsetTallyCache::Tallies(CandMask alive, Doubles &tallies) const{
+	tallies.resize(ncand);
+
+	if(!table.empty()){
+		atomic<unsigned char> &st = state[alive];
+		double *row = &table[alive * ncand];
+
+		if(st.load(memory_order_acquire) == 2){
+			copy(row, row + ncand, tallies.begin());
+			return;
+		}
+
+		unsigned char expected = 0;
+		if(st.compare_exchange_strong(expected, 1)){
+			Compute(alive, row);
+			st.store(2, memory_order_release);
+			copy(row, row + ncand, tallies.begin());
+			return;
+		}
+	}
+
+	// No table, or another thread is filling this row
+	Compute(alive, &tallies[0]);
+}
+
+// As for Visit, but only votes reaching 'c' are counted (in 'base'). The
+// candidates passed over to reach a node are path[0] to path[depth-1]. If
+// any one of these also remained, the votes reaching 'c' through the node
+// would count toward it instead, and so are added to its entry in 'lost'.
+void SubsetTallyCache::VisitWith(int first, int count, CandMask alive, 
+	int c, int *path, int depth, double &base, double *lost) const{
+	for(int i = first; i < first + count; ++i){
+		const TrieNode &n = nodes[i];
+		if((alive >> n.cand) & 1){
+			if(n.cand == c){
+				base += n.votes;
+				for(int j = 0; j < depth; ++j){
+					lost[path[j]] += n.votes;
+				}
+			}
+		}
+		else if(n.nchildren > 0){
+			path[depth] = n.cand;
+			VisitWith(n.first, n.nchildren, alive, c, path, depth+1, 
+				base, lost);
+		}
+	}
+}
+
+void SubsetTallyCache::TalliesWith(CandMask alive, int c, 
+	Doubles &tallies) const{
+	int path[MAX_TREE_CANDIDATES];
+	double lost[MAX_TREE_CANDIDATES];
+	double base = 0;
+
+	fill(lost, lost + ncand, 0.0);
+	VisitWith(0, nroots, alive, c, path, 0, base, lost);
+
+	tallies.resize(ncand);
+	for(int e = 0; e < ncand; ++e){
+		tallies[e] = ((alive >> e) & 1) ? 0 : base - lost[e];
+	}
+}
+
+// Add the votes of ballots passing through sibling nodes nodes[first] to
+// nodes[first+count-1] to counts[c*ncand + e] for the candidate 'c' at
+// each node and every 'e' not yet passed over ('path') on the way to it.
+void SubsetTallyCache::VisitAbove(int first, int count, CandMask stop,
+	CandMask path, double *counts) const{
+	for(int i = first; i < first + count; ++i){
+		const TrieNode &n = nodes[i];
+		if((stop >> n.cand) & 1) continue;
+
+		const CandMask seen = path | (CandMask(1) << n.cand);
+		double *row = counts + n.cand * ncand;
+		for(int e = 0; e < ncand; ++e){
+			if(!((seen >> e) & 1)) row[e] += n.votes;
+		}
+
+		if(n.nchildren > 0){
+			VisitAbove(n.first, n.nchildren, stop, seen, counts);
+		}
+	}
+}
+
+void SubsetTallyCache::AboveWithin(CandMask stop, Doubles &counts) const{
+	counts.assign(ncand * ncand, 0);
+	VisitAbove(0, nroots, stop, 0, &counts[0]);
+}
+
+double SubsetTallyCache::Tally(CandMask alive, int c) const{
+	if(table.empty()){
+		double tallies[MAX_TREE_CANDIDATES];
+		Compute(alive, tallies);
+		return tallies[c];
+	}
+
+	if(state[alive].load(memory_order_acquire) == 2){
+		return table[alive * ncand + c];
+	}
+
+	Doubles row;
+	Tallies(alive, row);
+	return row[c];
+}
@@ -0,0 +1,127 @@
+/*
+    Copyright (C) 2016-2019  Michelle Blom
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _SUBSET_TALLY_H
+#define _SUBSET_TALLY_H
+
+#include<vector>
+#include<atomic>
+#include<memory>
+#include "model.h"
+
+// Tallies of candidates given a set of continuing ('alive') candidates:
+// each ballot counts toward the first alive candidate in its preferences.
+// This is the quantity the scoring rules compute for every candidate they
+// consider, for one set of alive candidates at a time.
+//
+// Ballots are stored in a prefix trie, in which each node records the 
+// votes of all ballots passing through it. The tallies for a set of alive
+// candidates are computed by a depth first traversal that stops at each
+// alive candidate, so ballots sharing a prefix of eliminated candidates
+// are visited once. If a table of tallies for every subset of candidates
+// fits within the given memory limit, tallies are stored in it as they
+// are computed, so that later requests for the same subset are lookups.
+// Otherwise every request is computed directly from the trie.
+//
+// The pairwise counts used by the basic scoring rule (the votes in which
+// one candidate is ranked above another) are computed once, when the 
+// cache is built.
+//
+// The cache may be used by several threads at once.
+class SubsetTallyCache{
+	private:
+		struct TrieNode{
+			int cand;
+
+			// Total votes of ballots passing through this node
+			double votes;
+
+			// Children are nodes[first] to nodes[first+nchildren-1]
+			int first;
+			int nchildren;
+		};
+
+		int ncand;
+		std::vector<TrieNode> nodes;
+		int nroots;
+
+		// True if all signatures have a whole number of votes
+		bool integral;
+
+		// Tallies of each candidate for each subset (empty if the table
+		// does not fit in memory), and whether each row has been filled:
+		// 0 = empty, 1 = being filled, 2 = filled.
+		mutable std::vector<double> table;
+		std::unique_ptr<std::atomic<unsigned char>[]> state;
+
+		// above[c*ncand + e] is the number of votes in which 'c' is 
+		// ranked above 'e' (or 'c' appears and 'e' does not).
+		std::vector<double> above;
+
+		int BuildTrie(const BallotStore &store, std::vector<int> &sigs,
+			int lo, int hi, int depth);
+
+		void Visit(int first, int count, CandMask alive, 
+			double *tallies) const;
+		void Compute(CandMask alive, double *tallies) const;
+		void VisitWith(int first, int count, CandMask alive, int c,
+			int *path, int depth, double &base, double *lost) const;
+		void VisitAbove(int first, int count, CandMask stop, 
+			CandMask path, double *counts) const;
+
+	public:
+		// Build the trie for the ballots in 'store', with a table of 
+		// tallies if one fits in 'maxbytes' bytes.
+		SubsetTallyCache(const BallotStore &store, int ncandidates, 
+			size_t maxbytes);
+
+		// Number of votes counting toward candidate 'c' when the 
+		// candidates in 'alive' remain ('c' must be in 'alive').
+		double Tally(CandMask alive, int c) const;
+
+		// Tallies of all candidates when the candidates in 'alive'
+		// remain ('tallies' has one entry per candidate, 0 for those not
+		// in 'alive').
+		void Tallies(CandMask alive, Doubles &tallies) const;
+
+		// For each candidate 'e' not in 'alive', the number of votes 
+		// counting toward 'c' when the candidates in 'alive' and 'e' 
+		// remain ('c' must be in 'alive'). Entries for candidates in 
+		// 'alive' are 0. Computed with one traversal of the trie.
+		void TalliesWith(CandMask alive, int c, Doubles &tallies) const;
+
+		// Number of votes in which 'c' is ranked above 'e', or 'c' 
+		// appears and 'e' does not.
+		double Above(int c, int e) const { return above[c*ncand + e]; }
+
+		// As for Above, but only counting the preferences on each ballot
+		// before the first candidate in 'stop': counts[c*ncand + e] is the
+		// number of votes in which 'c' is ranked above 'e' and above all 
+		// candidates in 'stop'. Computed with one traversal of the trie.
+		void AboveWithin(CandMask stop, Doubles &counts) const;
+
+		// True if every signature has a whole number of votes. The scoring
+		// rules accumulate votes into integers ballot by ballot, so they
+		// only use the cache when this holds.
+		bool Integral() const { return integral; }
+
+		bool Tabulated() const { return !table.empty(); }
+		size_t TrieSize() const { return nodes.size(); }
+};
+
+#endif
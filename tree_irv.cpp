@@ -17,54 +17,137 @@
 
 
 #include<set>
-#include<vector>
 #include<list>
+#include<vector>
+#include<algorithm>
 #include<iostream>
 #include<fstream>
 #include<cmath>
 #include<sstream>
+#include<iomanip>
+#include<cstdio>
+#include<thread>
+#include<mutex>
+#include<atomic>
+#include<condition_variable>
 
 #include "tree_irv.h"
 #include "irv_distance.h"
+#include "distance_cache.h"
 
 using namespace std;
 
-typedef list<Node> Fringe;
 typedef vector<Node> Nodes;
 
-// Node 'n' will be inserted into the fringe so that
-// the fringe remains sorted in order of n.dist. 
-void InsertIntoFringe(const Node &n, Fringe &fringe){
-	Fringe::iterator it = fringe.begin();
-	for( ; it != fringe.end(); ++it){
-		if(n.dist < it->dist || (n.dist == it->dist &&
-			n.order_c.size() > it->order_c.size())){
-			break;
+// Entry in the search frontier. 'seq' records the order in which nodes
+// were added, and is used to break ties between nodes of equal priority.
+struct FringeEntry{
+	Node node;
+	long seq;
+
+	FringeEntry(const Node &n, long s) : node(n), seq(s) {}
+};
+
+// Returns true if the node in 'a' should be expanded after the node in 'b'.
+// Nodes are expanded in order of increasing distance, with ties broken in
+// favour of longer elimination sequences, and then in order of insertion.
+struct FringeOrder{
+	bool operator()(const FringeEntry &a, const FringeEntry &b) const{
+		if(a.node.dist != b.node.dist){
+			return a.node.dist > b.node.dist;
 		}
+		if(a.node.Size() != b.node.Size()){
+			return a.node.Size() < b.node.Size();
+		}
+		return a.seq > b.seq;
 	}
-	
-	fringe.insert(it, n);
-}
+};
+
+// Search frontier, maintained as a binary heap so that insertion and
+// removal of the best node cost O(log n). Nodes whose distance reaches
+// the current upper bound are not removed when the bound is updated; they
+// are discarded as they reach the top of the heap (see RunTreeIRV).
+class Fringe{
+	private:
+		vector<FringeEntry> heap;
+		long nextseq;
+
+	public:
+		Fringe() : nextseq(0) {}
+
+		bool empty() const { return heap.empty(); }
+		size_t size() const { return heap.size(); }
+
+		// Node with the smallest distance.
+		const Node& top() const { return heap.front().node; }
+
+		// Nodes that have not been pruned by 'ubound', in the order in
+		// which they would be expanded.
+		void GetNodes(double ubound, Nodes &nodes) const{
+			vector<FringeEntry> sorted;
+			for(int i = 0; i < heap.size(); ++i){
+				if(heap[i].node.dist < ubound){
+					sorted.push_back(heap[i]);
+				}
+			}
+			sort(sorted.begin(), sorted.end(), FringeOrder());
+			for(int i = sorted.size()-1; i >= 0; --i){
+				nodes.push_back(sorted[i].node);
+			}
+		}
+
+		void push(const Node &n){
+			heap.push_back(FringeEntry(n, nextseq++));
+			push_heap(heap.begin(), heap.end(), FringeOrder());
+		}
+
+		void pop(){
+			pop_heap(heap.begin(), heap.end(), FringeOrder());
+			heap.pop_back();
+		}
+
+		// Best lower bound on the margin given by nodes in the fringe,
+		// capped at the current upper bound 'ubound'.
+		double LowerBound(double ubound) const{
+			if(heap.empty()) return ubound;
+			return min(ubound, top().dist);
+		}
+
+		// Node that would be expanded last, ignoring nodes that have
+		// been pruned by 'ubound'. This is a linear scan, used only
+		// for logging.
+		const Node& last(double ubound) const{
+			int worst = 0;
+			for(int i = 1; i < heap.size(); ++i){
+				if(heap[i].node.dist >= ubound) continue;
+				if(heap[worst].node.dist >= ubound ||
+					FringeOrder()(heap[i], heap[worst])){
+					worst = i;
+				}
+			}
+			return heap[worst].node;
+		}
+};
 
 
 void PrintNode(const Node &n, ostream &log){
-	for(int i = 0; i < n.order_c.size(); ++i){
-		log << n.order_c[i] << " ";
+	for(int i = 0; i < n.Size(); ++i){
+		log << n.At(i) << " ";
 	}
 
 	log << " with distance " << n.dist << " ";
 }
 
 // Print first and last nodes of the search frontier.
-void PrintFringe(const Fringe &fringe, ostream &log){
+void PrintFringe(const Fringe &fringe, double ubound, ostream &log){
 	log << "--------------------------------" << endl;
 	log << "Current state of priority queue: " << endl;
 	log << "    Node ";
-	PrintNode(fringe.front(), log);
+	PrintNode(fringe.top(), log);
 	log << endl;
 	log << "    .... " << endl;
 	log << "    Node ";
-	PrintNode(fringe.back(), log);
+	PrintNode(fringe.last(ubound), log);
 	log << endl;
 
 	log << "--------------------------------" << endl;
@@ -74,44 +157,512 @@ void PrintFringe(const Fringe &fringe, ostream &log){
 // candidate 'c' that is not in the node's current elimination order. In
 // each of these new nodes, 'c' is appended to the front of the 
 // elimination sequence. 
-void GetChildren(int ncand, int nballots, const Node &n, Nodes &children){
-	for(SInts::const_iterator it = n.remcand.begin(); 
-		it != n.remcand.end(); ++it){
-		Node newn(ncand, nballots);
-		newn.order_c = n.order_c;
-		newn.order_c.insert(newn.order_c.begin(), *it);
-		newn.remcand = n.remcand;
-		newn.remcand.erase(*it);
-		newn.dist = n.dist; 
+void GetChildren(int ncand, const Node &n, Nodes &children){
+	for(int c = 0; c < ncand; ++c){
+		if(!n.Remaining(c)) continue;
+
+		Node newn = n;
+		newn.Prepend(c);
 
 		children.push_back(newn);
 	}
 }
 
-// Remove all nodes whose current scores/distance values are greater than
-// or equal to the current upper bound (ubound).
-void PruneFringe(Fringe &fringe, double ubound, ostream &log, bool dolog){
-	for(Fringe::iterator it = fringe.begin(); it != fringe.end(); ){
-		if(it->dist >= ubound){
-			if(dolog){
-				log << "Pruning node ";
-				PrintNode(*it, log);
-				log << endl;
+// State shared by the threads taking part in a search. All members other
+// than 'ubound' and 'timeout' are protected by 'lock'. The current upper
+// bound is atomic so that a worker can prune against the latest incumbent
+// found by any other worker without taking the lock.
+struct TreeSearch{
+	const Ballots &ballots;
+	const Candidates &cands;
+	const Config &config;
+	const Ints &altwinners;
+	DistanceCache &cache;
+
+	Fringe fringe;
+	atomic<double> ubound;
+	atomic<bool> timeout;
+	Ints best_order_c;
+	int dtcntr;
+
+	// Time (in seconds) spent by all workers building and solving LPs
+	double buildtime;
+	double solvetime;
+
+	// Number of workers currently expanding a node taken from the fringe.
+	// The search is over when the fringe is empty and this is zero.
+	int nexpanding;
+
+	// Nodes currently being expanded. These are saved in a checkpoint
+	// along with the fringe, as their children may not all have been 
+	// evaluated.
+	list<Node> expanding;
+
+	mutex lock;
+	condition_variable changed;
+
+	mytimespec start;
+	double timelimit;
+
+	// File to which the state of the search is saved (NULL if none), 
+	// and the interval (in seconds) between saves. If the interval is
+	// not positive, the state is only saved when the search ends.
+	const char *checkpointf;
+	double checkpointint;
+	double lastcheckpoint;
+
+	ofstream &log;
+	bool dolog;
+
+	// Message of an exception raised in a worker thread.
+	string error;
+
+	TreeSearch(const Ballots &b, const Candidates &c, const Config &cf,
+		const Ints &aw, DistanceCache &dc, ofstream &lg, bool dl) : 
+		ballots(b), cands(c), config(cf), altwinners(aw), cache(dc),
+		ubound(0), timeout(false), dtcntr(0), buildtime(0), solvetime(0),
+		nexpanding(0), timelimit(-1),
+		checkpointf(NULL), checkpointint(-1), lastcheckpoint(0),
+		log(lg), dolog(dl) {}
+};
+
+static const char *CHECKPOINT_HEADER = "MARGINIRV CHECKPOINT 1";
+
+// Save the state of search 'ts' to file 'path': the current upper bound
+// and best elimination order, the number of LPs solved, and every node
+// that could still improve on the upper bound (those in the fringe, and
+// those being expanded). The file also identifies the election and 
+// settings for which the search was run, so that it can only be resumed
+// by the same search. The caller must hold ts.lock.
+void SaveCheckpoint(TreeSearch &ts, const char *path){
+	const Config &config = ts.config;
+	const double ubound = ts.ubound;
+
+	Nodes nodes(ts.expanding.begin(), ts.expanding.end());
+	ts.fringe.GetNodes(ubound, nodes);
+
+	// Write to a temporary file first, so that an interrupted save does
+	// not destroy the previous checkpoint.
+	const string tmp = string(path) + ".tmp";
+	ofstream out(tmp.c_str());
+	out << setprecision(17);
+
+	out << CHECKPOINT_HEADER << endl;
+	out << "profile " << hex << ProfileHash(ts.ballots, config) << dec 
+		<< endl;
+	out << "ncandidates " << config.ncandidates << endl;
+	out << "bounds " << config.compbounds << " " << config.tightbounds 
+		<< endl;
+
+	out << "altwinners " << ts.altwinners.size();
+	for(int i = 0; i < ts.altwinners.size(); ++i){
+		out << " " << ts.altwinners[i];
+	}
+	out << endl;
+
+	out << "ubound " << ubound << endl;
+	out << "dtcntr " << ts.dtcntr << endl;
+
+	out << "best " << ts.best_order_c.size();
+	for(int i = 0; i < ts.best_order_c.size(); ++i){
+		out << " " << ts.best_order_c[i];
+	}
+	out << endl;
+
+	out << "nodes " << nodes.size() << endl;
+	for(int i = 0; i < nodes.size(); ++i){
+		const Node &n = nodes[i];
+		out << n.dist << " " << n.Size();
+		for(int j = 0; j < n.Size(); ++j){
+			out << " " << n.At(j);
+		}
+		out << endl;
+	}
+
+	out.close();
+	if(!out || rename(tmp.c_str(), path) != 0){
+		throw STVException("Error writing checkpoint file " + 
+			string(path) + ".");
+	}
+
+	mytimespec tnow;
+	GetTime(&tnow);
+	ts.lastcheckpoint = tnow.seconds;
+
+	if(ts.dolog){
+		ts.log << "Saved checkpoint with " << nodes.size() << 
+			" nodes to " << path << endl;
+	}
+}
+
+// Read the next token from 'in', which must be 'expected'.
+static void ExpectToken(istream &in, const string &expected, 
+	const string &path){
+	string token;
+	if(!(in >> token) || token != expected){
+		throw STVException("Error reading checkpoint file " + path + 
+			": expected '" + expected + "'.");
+	}
+}
+
+static STVException CheckpointMismatch(const string &path){
+	return STVException("Checkpoint file " + path + " was saved by a"
+		" search of a different election, or with different settings.");
+}
+
+// Read an integer from 'in', which must be equal to 'expected'. 
+static void ExpectValue(istream &in, long long expected, 
+	const string &path){
+	long long value;
+	if(!(in >> value) || value != expected){
+		throw CheckpointMismatch(path);
+	}
+}
+
+// Restore the state of search 'ts' from a file written by SaveCheckpoint.
+// Throws an STVException if the file cannot be read, or was saved by a
+// search of a different profile or with different alternate winners or 
+// scoring rules.
+void LoadCheckpoint(TreeSearch &ts, const char *path){
+	const Config &config = ts.config;
+	const string spath(path);
+
+	ifstream in(path);
+	if(!in.is_open()){
+		throw STVException("Could not open checkpoint file " + spath + ".");
+	}
+
+	string header;
+	getline(in, header);
+	if(!header.empty() && header[header.size()-1] == '\r'){
+		header.erase(header.size()-1);
+	}
+	if(header != CHECKPOINT_HEADER){
+		throw STVException(spath + " is not a checkpoint file.");
+	}
+
+	unsigned long long hash = 0;
+	ExpectToken(in, "profile", spath);
+	in >> hex >> hash >> dec;
+	if(!in || hash != ProfileHash(ts.ballots, config)){
+		throw CheckpointMismatch(spath);
+	}
+
+	ExpectToken(in, "ncandidates", spath);
+	ExpectValue(in, config.ncandidates, spath);
+
+	ExpectToken(in, "bounds", spath);
+	ExpectValue(in, config.compbounds, spath);
+	ExpectValue(in, config.tightbounds, spath);
+
+	ExpectToken(in, "altwinners", spath);
+	ExpectValue(in, ts.altwinners.size(), spath);
+	for(int i = 0; i < ts.altwinners.size(); ++i){
+		ExpectValue(in, ts.altwinners[i], spath);
+	}
+
+	double ubound = 0;
+	int nbest = 0;
+	ExpectToken(in, "ubound", spath);
+	in >> ubound;
+	ExpectToken(in, "dtcntr", spath);
+	in >> ts.dtcntr;
+	ExpectToken(in, "best", spath);
+	in >> nbest;
+
+	if(!in || nbest < 0 || nbest > config.ncandidates){
+		throw STVException("Error reading checkpoint file " + spath + ".");
+	}
+
+	ts.best_order_c.resize(nbest);
+	for(int i = 0; i < nbest; ++i){
+		in >> ts.best_order_c[i];
+	}
+
+	if(ubound < ts.ubound){
+		ts.ubound = ubound;
+	}
+
+	int nnodes = 0;
+	ExpectToken(in, "nodes", spath);
+	in >> nnodes;
+	if(nnodes < 0){
+		in.setstate(ios::failbit);
+	}
+
+	// Every node must be read: resuming with part of the fringe would
+	// report a margin that may be too large.
+	int nread = 0;
+	for(; nread < nnodes && in; ++nread){
+		int len = 0;
+		Ints order_c;
+		Node n;
+
+		in >> n.dist >> len;
+		if(!in || len <= 0 || len > config.ncandidates){
+			in.setstate(ios::failbit);
+			break;
+		}
+
+		order_c.resize(len);
+		for(int j = 0; j < len; ++j){
+			in >> order_c[j];
+		}
+
+		// Rebuild the node by prepending candidates from the winner on
+		for(int j = 0; j < config.ncandidates; ++j){
+			n.remcand |= CandMask(1) << j;
+		}
+		for(int j = len-1; j >= 0; --j){
+			if(order_c[j] < 0 || order_c[j] >= config.ncandidates ||
+				!n.Remaining(order_c[j])){
+				in.setstate(ios::failbit);
+				break;
 			}
+			n.Prepend(order_c[j]);
+		}
 
-			if(fringe.size() == 1){
-				fringe.clear();
-				return;
+		if(!in){
+			break;
+		}
+
+		if(n.dist < ts.ubound){
+			ts.fringe.push(n);
+		}
+	}
+
+	if(!in || nread != nnodes){
+		throw STVException("Error reading checkpoint file " + spath + ".");
+	}
+
+	if(ts.dolog){
+		ts.log << "Resumed search from " << spath << " with " << 
+			ts.fringe.size() << " nodes, upper bound " << ts.ubound <<
+			", and " << ts.dtcntr << " LPs solved" << endl;
+	}
+}
+
+// Create and evaluate the children of node 'expand', adding those that
+// could still improve on the current upper bound to the fringe. Returns
+// false if the time limit was reached before all children were evaluated.
+bool ExpandNode(TreeSearch &ts, const Node &expand, DistanceScratch &scratch){
+	const Config &config = ts.config;
+
+	// Logging of CPLEX output is only possible when a single thread is
+	// writing to the log.
+	const bool lplog = ts.dolog && config.nthreads <= 1;
+
+	Nodes children;
+	GetChildren(config.ncandidates, expand, children);
+
+	if(config.compbounds){
+		// Evaluate lower bound on margin for all children
+		ApplyScoringRules(ts.ballots, ts.cands, config, expand, children);
+	}
+
+	double tleft = -1;
+	for(int i = 0; i < children.size(); ++i){
+		if(ts.timeout){
+			return false;
+		}
+
+		if(ts.timelimit != -1){
+			mytimespec tnow;
+			GetTime(&tnow);
+		
+			tleft = ts.timelimit - (tnow.seconds-ts.start.seconds);
+			if(tleft <= 0){
+				ts.timeout = true;
+				return false;
 			}
+		}
 
-			fringe.erase(it++);
+		Node &child = children[i];
+		if(config.compbounds){
+			if(ts.dolog){
+				lock_guard<mutex> guard(ts.lock);
+				ts.log << "Score for child ";
+				PrintNode(child, ts.log);
+				ts.log << endl;
+			}
 		}
-		else{
-			++it;		
+
+		if(child.dist >= ts.ubound){
+			if(ts.dolog){
+				lock_guard<mutex> guard(ts.lock);
+				ts.log << "    skipping child" << endl;
+			}
+			continue;
 		}
+
+		// Solve an LP for the node unless its elimination sequence
+		// has been evaluated before.
+		bool lptimeout = false;
+		const double ubound = ts.ubound;
+		double dist = -1;
+		const bool cached = ts.cache.Lookup(child, ubound, dist);
+
+		if(!cached){
+			dist = distance(ts.ballots, ts.cands, config, child, 
+				ubound, tleft, ts.log, lplog, lptimeout, scratch);
+			ts.cache.Store(child, ubound, dist, lptimeout);
+		}
+		child.dist = dist;
+
+		lock_guard<mutex> guard(ts.lock);
+		if(!cached){
+			++ts.dtcntr;
+		}
+
+		if(ts.dolog){
+			ts.log << "    DT value: " << child.dist;
+			if(cached){
+				ts.log << " (cached)";
+			}
+			ts.log << endl;
+		}
+
+		if(lptimeout){
+			ts.timeout = true;
+			return false;
+		} 
+
+		if(child.dist < 0)
+			continue;
+
+		if(child.dist >= 0 && child.dist < ts.ubound){
+			if(ts.dolog){
+				ts.log << "Adding node to fringe: ";
+				PrintNode(child, ts.log);
+				ts.log << endl;
+			}
+			ts.fringe.push(child);
+			ts.changed.notify_one();
+		}
+
+		if(child.remcand == 0 && child.dist < ts.ubound){
+			ts.ubound = child.dist;
+
+			child.GetOrder(ts.best_order_c);
+
+			// Update current upper bound if a leaf found. Nodes
+			// in the fringe that can no longer improve on it are
+			// discarded as they reach the top of the fringe.
+		}
+	}
+
+	return true;
+}
+
+// Stop the search after a worker raised an error. Nodes are expanded with
+// 'guard' unlocked, so it is retaken before the shared state is written. 
+// Only the first error is kept.
+void StopOnError(TreeSearch &ts, unique_lock<mutex> &guard, 
+	const string &error){
+	if(!guard.owns_lock()){
+		guard.lock();
+	}
+	if(ts.error.empty()){
+		ts.error = error;
 	}
+	ts.timeout = true;
 }
 
+// Repeatedly expand the best node in the fringe until the fringe is
+// exhausted, or the time limit is reached. With a single thread this is
+// the usual best-first branch and bound; with several, each thread runs
+// this loop and expands a different node.
+void SearchWorker(TreeSearch &ts){
+	DistanceScratch scratch;
+
+	unique_lock<mutex> guard(ts.lock);
+	try{
+		while(true){
+			// Wait for work until no other worker can produce any more.
+			while(!ts.timeout && ts.fringe.empty() && ts.nexpanding > 0){
+				ts.changed.wait(guard);
+			}
+
+			if(ts.timeout || ts.fringe.empty()){
+				break;
+			}
+
+			if(ts.checkpointf != NULL && ts.checkpointint > 0){
+				mytimespec tnow;
+				GetTime(&tnow);
+				if(tnow.seconds - ts.lastcheckpoint >= ts.checkpointint){
+					SaveCheckpoint(ts, ts.checkpointf);
+				}
+			}
+
+			// Nodes are pruned lazily: once the best node in the fringe
+			// cannot improve on the current upper bound, neither can
+			// any of the others.
+			if(ts.fringe.top().dist >= ts.ubound){
+				if(ts.dolog){
+					ts.log << "Pruning node ";
+					PrintNode(ts.fringe.top(), ts.log);
+					ts.log << endl;
+				}
+
+				ts.fringe.pop();
+				continue;
+			}
+
+			if(ts.dolog){
+				PrintFringe(ts.fringe, ts.ubound, ts.log);
+				ts.log << "CURRENT UPPER BOUND = " << ts.ubound << endl;
+				ts.log << "BEST LOWER BOUND = " << 
+					ts.fringe.LowerBound(ts.ubound) << endl;
+			}
+
+			// Expand first node in fringe: Get/evaluate children 
+			Node expand = ts.fringe.top();
+			ts.fringe.pop();
+
+			if(ts.dolog){
+				ts.log << "Expanding ";
+				PrintNode(expand, ts.log);
+				ts.log << endl;
+			}
+
+			++ts.nexpanding;
+			list<Node>::iterator inflight = 
+				ts.expanding.insert(ts.expanding.end(), expand);
+			guard.unlock();
+
+			bool complete = ExpandNode(ts, expand, scratch);
+
+			guard.lock();
+			--ts.nexpanding;
+			ts.expanding.erase(inflight);
+
+			if(!complete){
+				// Some children of the node were not evaluated, so it
+				// still contributes to the lower bound on the margin.
+				ts.fringe.push(expand);
+			}
+			ts.changed.notify_all();
+		}
+	}
+	catch(exception &e){
+		StopOnError(ts, guard, e.what());
+	}
+	catch(STVException &e){
+		StopOnError(ts, guard, e.what());
+	}
+	catch(...){
+		StopOnError(ts, guard, "Unexpected error.");
+	}
+
+	if(!guard.owns_lock()){
+		guard.lock();
+	}
+	ts.buildtime += scratch.buildtime;
+	ts.solvetime += scratch.solvetime;
+
+	ts.changed.notify_all();
+}
 
 // Implements branch and bound search given:
 //   INPUT
@@ -123,23 +674,38 @@ void PruneFringe(Fringe &fringe, double ubound, ostream &log, bool dolog){
 //   upperbound: starting upper bound on margin.
 //   timelimit:  timelimit (in seconds) after which search terminates.
 //   logf:       file for logging (NULL if not logging)
+//   checkpointf: file to which the state of the search is saved when
+//               it terminates (NULL if not saving)
+//   checkpointint: if positive, the state of the search is also saved
+//               every 'checkpointint' seconds
+//   resumef:    file, written by an earlier run of the same search, from
+//               which the search is resumed (NULL to start afresh)
 //
 //   OUTPUT
 //   timeout:    True if search times out, false otherwise
-//   dtcntr:     Number of 'distance to' LPs solved
+//   dtcntr:     Number of 'distance to' LPs solved (including those 
+//               solved before the search was checkpointed, if resumed)
+//   buildtime:  Time (in seconds, summed over threads) spent building LPs
+//   solvetime:  Time (in seconds, summed over threads) spent solving LPs
+//   cache:      LP results for elimination sequences; it is consulted
+//               before solving an LP, and every LP solved is added to it
 //   
 //   RETURNS
 //   margin:     Margin for election (or lower bound on margin if
 //               search times out).    
 double RunTreeIRV(const Ballots &ballots, const Candidates &cands,
 	const Config &config, const Ints &altwinners, int upperbound, 
-	double timelimit, const char *logf, bool &timeout, int &dtcntr)
+	double timelimit, const char *logf, const char *checkpointf,
+	double checkpointint, const char *resumef, bool &timeout, 
+	int &dtcntr, double &buildtime, double &solvetime, DistanceCache &cache)
 {
 	try{
-		mytimespec start;
-		GetTime(&start);
-
-		Fringe fringe;
+		if(config.ncandidates > MAX_TREE_CANDIDATES){
+			stringstream ss;
+			ss << "Margin computation supports at most " <<
+				MAX_TREE_CANDIDATES << " candidates.";
+			throw STVException(ss.str());
+		}
 
 		ofstream log;
 		bool dolog = false;
@@ -147,18 +713,30 @@ double RunTreeIRV(const Ballots &ballots, const Candidates &cands,
 			log.open(logf);
 			dolog = true;
 		}
+
+		TreeSearch ts(ballots, cands, config, altwinners, cache, log, 
+			dolog);
+		GetTime(&ts.start);
+		ts.timelimit = timelimit;
+		ts.dtcntr = dtcntr;
+		ts.checkpointf = checkpointf;
+		ts.checkpointint = checkpointint;
+		ts.lastcheckpoint = ts.start.seconds;
+		ts.ubound = upperbound;
+
+		if(resumef != NULL){
+			LoadCheckpoint(ts, resumef);
+		}
 	
 		// BUILD FRINGE: we are interested in one of the candidates in
 		// 'altwinners' winning the election.
-		for(int i = 0; i < altwinners.size(); ++i){
-			Node newn(cands.size(), ballots.size());
+		for(int i = 0; i < altwinners.size() && resumef == NULL; ++i){
+			Node newn;
 			newn.dist = 0;
-			newn.order_c.push_back(altwinners[i]);
 			for(int j = 0; j < cands.size(); ++j){
-				if(j != altwinners[i]){
-					newn.remcand.insert(j);
-				}
+				newn.remcand |= CandMask(1) << j;
 			}
+			newn.Prepend(altwinners[i]);
 
 			if(config.compbounds){
 				// Evaluate lower bound on margin for node
@@ -172,124 +750,45 @@ double RunTreeIRV(const Ballots &ballots, const Candidates &cands,
 
 			// Run distance to get more precise lower bound
 			if(newn.dist >= 0 && newn.dist < upperbound){
-				InsertIntoFringe(newn, fringe);
+				ts.fringe.push(newn);
 			}
 		}
 
-		Ints best_order_c;
-
-		double curr_ubound = upperbound;
-
-		timeout = false;
-		while(fringe.size() > 0){
-			if(dolog){
-				PrintFringe(fringe, log);
-				log << "CURRENT UPPER BOUND = " << curr_ubound << endl;
-			}
-
-			double blower = curr_ubound;
-			for(Fringe::const_iterator it = fringe.begin();
-				it != fringe.end(); ++it){
-				blower = min(blower, it->dist);
+		if(config.nthreads > 1){
+			vector<thread> workers;
+			for(int i = 0; i < config.nthreads; ++i){
+				workers.push_back(thread(SearchWorker, ref(ts)));
 			}
-
-			if(dolog){
-				log << "BEST LOWER BOUND = " << blower << endl;
-			}
-
-			mytimespec tnow;
-			GetTime(&tnow);
-
-			// Expand first node in fringe: Get/evaluate children 
-			Node expand = *(fringe.begin());
-			fringe.erase(fringe.begin());
-
-			if(dolog){
-				log << "Expanding ";
-				PrintNode(expand, log);
-				log << endl;
+			for(int i = 0; i < workers.size(); ++i){
+				workers[i].join();
 			}
+		}
+		else{
+			SearchWorker(ts);
+		}
 
-			Nodes children;
-			GetChildren(config.ncandidates, ballots.size(), expand, children);
-
-			double tleft = -1;
-			int nchildrenadded = 0;
-			for(int i = 0; i < children.size(); ++i){
-				if(timelimit != -1){
-					mytimespec tnow;
-					GetTime(&tnow);
-				
-					tleft = timelimit - (tnow.seconds-start.seconds);
-					if(tleft <= 0){
-						timeout = true;
-						break;
-					}
-				}
-
-				Node &child = children[i];
-				if(config.compbounds){
-					// Evaluate lower bound on margin for node
-					ApplyScoringRules(ballots, cands, config, child);
-					if(dolog){
-						log << "Score for child ";
-						PrintNode(child, log);
-						log << endl;
-					}
-				}
-
-				if(child.dist >= curr_ubound){
-					if(dolog){
-						log << "    skipping child" << endl;
-					}
-					continue;
-				}
-
-				child.dist = distance(ballots, cands, config, child, 
-					curr_ubound, tleft, log, dolog, timeout);
-				++dtcntr;
-
-				if(dolog){
-					log << "    DT value: " << child.dist << endl;
-				}
-
-				if(timeout){
-					break;
-				} 
-
-				if(child.dist < 0)
-					continue;
-
-				if(child.dist >= 0 && child.dist < curr_ubound){
-					if(dolog){
-						log << "Adding node to fringe: ";
-						PrintNode(child, log);
-						log << endl;
-					}
-					InsertIntoFringe(child, fringe);
-					nchildrenadded += 1;
-				}
-
-				if(child.remcand.empty() && child.dist < curr_ubound){
-					curr_ubound = child.dist;
+		if(!ts.error.empty()){
+			throw STVException(ts.error);
+		}
 
-					best_order_c = child.order_c;
+		if(checkpointf != NULL){
+			lock_guard<mutex> guard(ts.lock);
+			SaveCheckpoint(ts, checkpointf);
+		}
 
-					// Update current upper bound if a leaf found.
-					PruneFringe(fringe, curr_ubound, log, dolog);
-				}
-			}
+		timeout = ts.timeout;
+		dtcntr = ts.dtcntr;
+		buildtime = ts.buildtime;
+		solvetime = ts.solvetime;
 
-			if(timeout){
-				break;
-			}
-		}
+		const double curr_ubound = ts.ubound;
+		const Ints &best_order_c = ts.best_order_c;
 
 		mytimespec tnow;
 		GetTime(&tnow);
 		if(dolog){
 			log << "TOTAL TIME USED SO FAR: " << tnow.seconds -
-				start.seconds << endl;
+				ts.start.seconds << endl;
 		}
 
 		if(dolog && !timeout){
@@ -312,11 +811,7 @@ double RunTreeIRV(const Ballots &ballots, const Candidates &cands,
 			log.close();
 		}
 
-		double blower = curr_ubound;
-		for(Fringe::const_iterator it = fringe.begin();
-			it != fringe.end(); ++it){
-			blower = min(blower, it->dist);
-		}
+		double blower = ts.fringe.LowerBound(curr_ubound);
 
 		if(dolog && timeout){
 			log << "Timeout: bounds on margin are [" << 
@@ -20,6 +20,7 @@
 #define _TREE_IRV_H
 
 #include "model.h"
+#include "distance_cache.h"
 
 // Implements branch and bound search given:
 //   INPUT
@@ -31,16 +32,31 @@
 //   upperbound: starting upper bound on margin.
 //   timelimit:  timelimit (in seconds) after which search terminates.
 //   logf:       file for logging (NULL if not logging)
+//   checkpointf: file to which the state of the search is saved when
+//               it terminates (NULL if not saving)
+//   checkpointint: if positive, the state of the search is also saved
+//               every 'checkpointint' seconds
+//   resumef:    file, written by an earlier run of the same search, from
+//               which the search is resumed (NULL to start afresh)
 //
 //   OUTPUT
 //   timeout:    True if search times out, false otherwise
-//   dtcntr:     Number of 'distance to' LPs solved
+//   dtcntr:     Number of 'distance to' LPs solved (including those 
+//               solved before the search was checkpointed, if resumed)
+//   buildtime:  Time (in seconds, summed over threads) spent building LPs
+//               (forming equivalence classes, creating or updating models)
+//   solvetime:  Time (in seconds, summed over threads) spent solving LPs
+//   cache:      LP results for elimination sequences; it is consulted
+//               before solving an LP, and every LP solved is added to it
 //   
 //   RETURNS
 //   margin:     Margin for election (or lower bound on margin if
 //               search times out).
 double RunTreeIRV(const Ballots &ballots, const Candidates &cands,
 	const Config &config, const Ints &altwinners, int upperbound,
-	double timelimit, const char *logf, bool &timeout, int &dtcntr);
+	double timelimit, const char *logf, const char *checkpointf,
+	double checkpointint, const char *resumef, bool &timeout, 
+	int &dtcntr, double &buildtime, double &solvetime, 
+	DistanceCache &cache);
 
 #endif